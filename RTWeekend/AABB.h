@@ -1,8 +1,13 @@
 #ifndef AABB_H
 #define AABB_H
 
+#include <cfloat>
+
 #include "Ray.h"
 
+// Bound of the relative rounding error of three float operations, see PBRT.
+const float s_AABBGamma3 = (3.0f * 0.5f * FLT_EPSILON) / (1.0f - 3.0f * 0.5f * FLT_EPSILON);
+
 class AABB
 {
 public:
@@ -13,12 +18,51 @@ public:
 		this->max = max;
 	}
 
+	static AABB Empty()
+	{
+		return AABB(Vector3f::PlusInf, Vector3f::MinusInf);
+	}
+
 	void Encapsulate(const AABB& aabb)
 	{
 		min = Min(min, aabb.min);
 		max = Max(max, aabb.max);
 	}
 
+	void Encapsulate(const Vector3f& point)
+	{
+		min = Min(min, point);
+		max = Max(max, point);
+	}
+
+	// Shrinks the box to its intersection with aabb. The result is empty if they do not overlap.
+	void Clip(const AABB& aabb)
+	{
+		min = Max(min, aabb.min);
+		max = Min(max, aabb.max);
+	}
+
+	bool IsEmpty() const
+	{
+		return min.x > max.x || min.y > max.y || min.z > max.z;
+	}
+
+	Vector3f Center() const
+	{
+		return 0.5f * (min + max);
+	}
+
+	Vector3f Extent() const
+	{
+		return max - min;
+	}
+
+	float SurfaceArea() const
+	{
+		Vector3f e = Extent();
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
 	bool Hit(const RayDesc& rayDesc) const
 	{
 		// A Ray-Box Intersection Algorithm and Efficient Dynamic Voxel Rendering, Majercik et al.
@@ -32,10 +76,105 @@ public:
 		return (tmin <= tmax);
 	}
 
+	// Slab test that picks the near and far planes from the ray direction signs instead of using min / max.
+	// On a hit, tEntry receives the distance at which the ray enters the box (clamped to tmin).
+	inline bool Hit(const TraversalRay& ray, float tmin, float tmax, float& tEntry) const
+	{
+		float tExit;
+		return Hit(ray, tmin, tmax, tEntry, tExit);
+	}
+
+	// Same as above, also returning where the ray leaves the box.
+	inline bool Hit(const TraversalRay& ray, float tmin, float tmax, float& tEntry, float& tExit) const
+	{
+		const Vector3f* bounds = &min;
+
+		float tx0 = (bounds[ray.directionIsNegative[0]].x - ray.origin.x) * ray.invDirection.x;
+		float tx1 = (bounds[1 - ray.directionIsNegative[0]].x - ray.origin.x) * ray.invDirection.x;
+		float ty0 = (bounds[ray.directionIsNegative[1]].y - ray.origin.y) * ray.invDirection.y;
+		float ty1 = (bounds[1 - ray.directionIsNegative[1]].y - ray.origin.y) * ray.invDirection.y;
+		float tz0 = (bounds[ray.directionIsNegative[2]].z - ray.origin.z) * ray.invDirection.z;
+		float tz1 = (bounds[1 - ray.directionIsNegative[2]].z - ray.origin.z) * ray.invDirection.z;
+
+		// The exit distances are rounded up as in PBRT, Ize, "Robust BVH Ray Traversal", 2013, so that rays through a
+		// vertex or edge on a face of the box are not culled by rounding. Triangle meshes rely on it to stay watertight.
+		const float roundUp = 1.0f + 2.0f * s_AABBGamma3;
+		tx1 *= roundUp;
+		ty1 *= roundUp;
+		tz1 *= roundUp;
+
+		// NaNs (0 * inf for rays lying in a slab plane) are discarded by the comparison order of FMIN / FMAX.
+		tEntry = FMAX(tx0, FMAX(ty0, FMAX(tz0, tmin)));
+		tExit = FMIN(tx1, FMIN(ty1, FMIN(tz1, tmax)));
+
+		return tEntry <= tExit;
+	}
+
 public:
 	Vector3f min;
 	Vector3f max;
 
 };
 
+static_assert(sizeof(AABB) == 2 * sizeof(Vector3f), "AABB::Hit indexes min and max as an array.");
+
+const uint32_t s_ClipPolygonMaxVertexCount = 4;
+
+// Bounds of the part of a convex polygon of up to s_ClipPolygonMaxVertexCount vertices inside clip, empty if there is
+// none. The polygon is clipped against the six planes of clip with Sutherland-Hodgman, each plane adds at most one vertex.
+inline void GetClippedPolygonBoundingBox(const Vector3f* vertices, uint32_t vertexCount, const AABB& clip, AABB& aabb)
+{
+	Vector3f polygon[2][s_ClipPolygonMaxVertexCount + 6];
+	uint32_t count = vertexCount;
+	for (uint32_t i = 0; i < vertexCount; i++)
+	{
+		polygon[0][i] = vertices[i];
+	}
+
+	int current = 0;
+	for (int plane = 0; plane < 6 && count > 0; plane++)
+	{
+		const int axis = plane >> 1;
+		const bool isMax = (plane & 1) != 0;
+		const float position = isMax ? clip.max[axis] : clip.min[axis];
+
+		auto inside = [&](const Vector3f& p) { return isMax ? p[axis] <= position : p[axis] >= position; };
+
+		const Vector3f* input = polygon[current];
+		Vector3f* output = polygon[current ^ 1];
+		uint32_t outputCount = 0;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const Vector3f& a = input[i];
+			const Vector3f& b = input[(i + 1) % count];
+			const bool aInside = inside(a);
+			const bool bInside = inside(b);
+
+			if (aInside)
+				output[outputCount++] = a;
+
+			if (aInside != bInside)
+			{
+				Vector3f p = a + (position - a[axis]) / (b[axis] - a[axis]) * (b - a);
+				p[axis] = position;
+				output[outputCount++] = p;
+			}
+		}
+
+		count = outputCount;
+		current ^= 1;
+	}
+
+	aabb = AABB::Empty();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		aabb.Encapsulate(polygon[current][i]);
+	}
+
+	// Rounding can put the intersection points just outside the box.
+	if (!aabb.IsEmpty())
+		aabb.Clip(clip);
+}
+
 #endif
@@ -0,0 +1,104 @@
+#ifndef ACCELERATION_STRUCTURE_H
+#define ACCELERATION_STRUCTURE_H
+
+#include <vector>
+
+#include "BVH.h"
+#include "BVHPrimitives.h"
+#include "Geometry.h"
+
+// Common interface of the acceleration structures a Scene can trace rays against, see AccelerationStructureType.
+class AccelerationStructure
+{
+public:
+	virtual ~AccelerationStructure() = default;
+
+	virtual AccelerationStructureType GetType() const = 0;
+
+	// Builds over the geometries, which must stay alive and unchanged until the next Build or Refit.
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) = 0;
+	virtual void Clear() = 0;
+
+	// Finds the closest hit in [tmin, tmax], like Geometry::Hit.
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const = 0;
+
+	// Updates the structure after geometries moved. Returns false if it has to be rebuilt instead, which is the
+	// only option for structures that cannot be refitted.
+	virtual bool Refit()
+	{
+		return false;
+	}
+
+	// Incremental edits, see Scene::Insert, Scene::Remove and Scene::UpdateGeometry. Each returns false if the structure
+	// has to be rebuilt instead, which only the DynamicBVH avoids. A geometry moving refits the whole structure by default.
+	virtual bool Insert(const Geometry* geometry)
+	{
+		return false;
+	}
+
+	virtual bool Remove(const Geometry* geometry)
+	{
+		return false;
+	}
+
+	virtual bool UpdateGeometry(const Geometry* geometry)
+	{
+		return Refit();
+	}
+
+	virtual size_t GetMemorySize() const = 0;
+};
+
+// No acceleration at all, the reference the other structures are measured against.
+class BruteForceAccelerationStructure : public AccelerationStructure
+{
+public:
+	virtual AccelerationStructureType GetType() const override
+	{
+		return AccelerationStructureType::BruteForce;
+	}
+
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) override
+	{
+		std::vector<uint32_t> indices(geometries.size());
+		for (uint32_t i = 0; i < indices.size(); i++)
+		{
+			indices[i] = i;
+		}
+
+		primitives.Build(geometries, indices.data(), indices.size());
+	}
+
+	virtual void Clear() override
+	{
+		primitives.Clear();
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		RayDesc tempRayDesc = rayDesc;
+
+		PrimitiveHit closestHit;
+		if (!primitives.Hit(0, static_cast<uint32_t>(primitives.size()), tempRayDesc, hitDesc, closestHit))
+			return false;
+
+		closestHit.Resolve(tempRayDesc, hitDesc);
+		return true;
+	}
+
+	virtual bool Refit() override
+	{
+		primitives.Refit();
+		return true;
+	}
+
+	virtual size_t GetMemorySize() const override
+	{
+		return primitives.GetMemorySize();
+	}
+
+private:
+	BVHPrimitives	primitives;
+};
+
+#endif // ACCELERATION_STRUCTURE_H
@@ -1,175 +1,1265 @@
 #ifndef BVH_H
 #define BVH_H
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "enkiTS/TaskScheduler_c.h"
+
 #include "Geometry.h"
-#include "Scene.h"
+#include "Morton.h"
 
-inline bool BoxCompare(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b, int axis)
+// Acceleration structure Scene::BuildAccelerationStructure creates. Only the BVH supports layouts, node orders, refitting,
+// profiling and saving, the others are mostly there to be benchmarked against it.
+enum class AccelerationStructureType
 {
-	AABB boxA;
-	AABB boxB;
+	BVH,
+	BruteForce,		// Tests every geometry.
+	UniformGrid,	// Cells of the scene bounds listing the geometries they overlap, traversed with a 3D DDA.
+	KdTree,			// SAH k-d tree, leaves list the geometries they overlap.
+	DynamicBVH,		// Binary BVH that geometries are inserted into and removed from without rebuilding it.
+};
 
-	a->GetBoundingBox(boxA);
-	b->GetBoundingBox(boxB);
-	
-	float* minAvec = &boxA.min.x;
-	float* minBvec = &boxB.min.x;
+enum class BVHBuildMode
+{
+	Median,	// Random split axis, split at the median primitive.
+	SAH,	// Binned surface area heuristic over primitive centroids.
+	LBVH,	// Linear BVH over sorted Morton codes of primitive centroids. Fastest to build, lowest tree quality.
+	SBVH,	// SAH with spatial splits that clip large primitives into several leaves. Slowest to build, fewest wasted box tests.
+};
 
-	return minAvec[axis] < minBvec[axis];
-}
+// Node layout the scene traverses. Wide layouts are collapsed from the binary BVH.
+enum class BVHLayout
+{
+	Binary,
+	Wide4,	// SSE child box tests.
+	Wide8,	// AVX2 child box tests, falls back to Wide4 when AVX2 is not enabled.
+	Quantized,	// Binary with 8 bit child bounds, about a third of the node memory.
+	Stackless,	// Binary with parent links, traversed without a per-ray stack.
+};
 
-bool BoxCompareX(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b)
+// Memory order of the nodes, applied after the build. Children are always stored after their parent.
+enum class BVHNodeOrder
 {
-	return BoxCompare(a, b, 0);
-}
+	DepthFirst,		// Every subtree is contiguous, the left one first.
+	VanEmdeBoas,	// Cache-oblivious: the top half of the levels first, then every subtree below it, recursively.
+	VisitCount,		// Most visited nodes first, from a profiling render, see Scene::BeginAccelerationStructureProfiling.
+};
 
-bool BoxCompareY(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b)
+struct BVHBuildSettings
 {
-	return BoxCompare(a, b, 1);
-}
+	AccelerationStructureType	type = AccelerationStructureType::BVH;
+
+	BVHBuildMode	mode = BVHBuildMode::SAH;
+	BVHLayout		layout = BVHLayout::Wide4;
+
+	// Maximum number of primitives per leaf, clamped to [1, s_BVHMaxLeafSize]. SAH and SBVH builds only make a leaf of
+	// that many primitives when no split is cheaper, the other modes always do.
+	uint32_t		maxLeafSize = 4;
+
+	// SAH only. Number of centroid bins per axis, clamped to [2, s_BVHMaxBinCount].
+	uint32_t		binCount = 16;
+
+	// SAH, SBVH and k-d tree only. Relative cost of visiting a node and of intersecting a primitive.
+	float			traversalCost = 1.0f;
+	float			intersectionCost = 1.0f;
+
+	// LBVH only. 30 bit codes (10 bits per axis) sort in 4 radix passes, 63 bit codes (21 bits per axis) in 8.
+	uint32_t		mortonCodeBits = 30;
+
+	// SBVH only. Spatial splits are only considered where the children of the best object split overlap by more than
+	// this fraction of the root surface area.
+	float			spatialSplitAlpha = 1e-5f;
 
-bool BoxCompareZ(const shared_ptr<Geometry> a, const shared_ptr<Geometry> b)
+	// SBVH only. Maximum number of additional primitive references created by spatial splits, relative to the primitive count.
+	float			spatialSplitBudget = 0.5f;
+
+	BVHNodeOrder	nodeOrder = BVHNodeOrder::DepthFirst;
+
+	// VisitCount only. Nodes visited by fewer rays than this fraction of the rays visiting the root are laid out in
+	// van Emde Boas order after all the more visited ones.
+	float			hotVisitFraction = 1.0f / 256.0f;
+
+	// BVH only. When non-zero, only the top levels of the tree are built by Scene::BuildAccelerationStructure, down to
+	// subtrees of at most this many primitives, which are built the first time a ray reaches them. See LazyBVH.
+	// Values up to s_BVHMaxLeafSize have no effect, the layout is ignored and the tree is not refitted but rebuilt.
+	uint32_t		lazySubtreeSize = 0;
+
+	// UniformGrid only. Target number of cells per geometry.
+	float			gridDensity = 4.0f;
+
+	// Subtrees are built in parallel on this scheduler. The build is single-threaded when null.
+	enkiTaskScheduler*	taskScheduler = nullptr;
+
+	// Subtrees with fewer primitives than this are built on the calling task.
+	uint32_t		parallelThreshold = 4096;
+
+	// Scene::UpdateAccelerationStructure rebuilds instead of refitting once the SAH cost of the refitted tree
+	// exceeds its cost right after the build by this factor.
+	float			refitRebuildThreshold = 1.5f;
+};
+
+const uint32_t s_BVHMaxBinCount = 64;
+const uint32_t s_BVHMaxLeafSize = 16;
+
+// Traversal stacks hold one entry per level, so no tree may be deeper than this. LBVH trees over 63 bit Morton codes
+// and SAH trees over degenerate input can be much deeper than balanced ones.
+const uint32_t s_BVHStackSize = 128;
+
+// Below this depth, nodes are split at their median primitive, which halves the primitive count at every level.
+// 32 more levels are enough for any primitive count, keeping all trees within s_BVHStackSize.
+const uint32_t s_BVHMedianSplitDepth = s_BVHStackSize - 32;
+
+struct BVHBuildNode
 {
-	return BoxCompare(a, b, 2);
-}
+	inline bool IsLeaf() const { return primitiveCount > 0; }
 
-static int s_BVHNodeCount = 0;
+	AABB		aabb;
+	uint32_t	offset;			// Leaf: first entry in BVHBuilder::primitiveIndices. Interior: index of the left child, the right child follows it.
+	uint32_t	primitiveCount;	// 0 for interior nodes.
+};
 
-class BVHNode
+// SBVH only. Part of a primitive inside a node. Spatial splits can split a reference in two, so a primitive can be
+// referenced by several leaves with smaller bounds than its own.
+struct BVHReference
+{
+	AABB		aabb;
+	uint32_t	primitive;
+};
+
+// Primitives a BVHBuilder builds over. Scene geometries go through GeometryPrimitiveSource, a TriangleMesh builds over
+// its triangles without a Geometry per triangle.
+class BVHPrimitiveSource
+{
+public:
+	virtual uint32_t GetPrimitiveCount() const = 0;
+	virtual void GetPrimitiveBoundingBox(uint32_t primitive, AABB& aabb) const = 0;
+
+	// SBVH only. Bounds of the part of the primitive inside clip, see Geometry::GetClippedBoundingBox.
+	virtual void GetClippedPrimitiveBoundingBox(uint32_t primitive, const AABB& clip, AABB& aabb) const = 0;
+
+	// Leaves store their primitives grouped by type.
+	virtual GeometryType GetPrimitiveType(uint32_t primitive) const = 0;
+};
+
+class GeometryPrimitiveSource : public BVHPrimitiveSource
 {
 public:
-	struct Data
+	GeometryPrimitiveSource() = default;
+
+	explicit GeometryPrimitiveSource(const std::vector<shared_ptr<Geometry>>& geometries) :
+		geometries(&geometries)
 	{
-		AABB					aabb;
-		shared_ptr<Geometry>	geometry;	// Valid only for leaf nodes.
-	};
+	}
 
-	inline int RandomInt(int min, int max) 
+	virtual uint32_t GetPrimitiveCount() const override
 	{
-		// Returns a random integer in [min,max].
-		return static_cast<int>(RandomFloat((float)min, (float)(max + 1)));
+		return static_cast<uint32_t>(geometries->size());
 	}
 
-	BVHNode(std::vector<shared_ptr<Geometry>>& geometries, size_t start, size_t end)
+	virtual void GetPrimitiveBoundingBox(uint32_t primitive, AABB& aabb) const override
 	{
-		s_BVHNodeCount++;
+		(*geometries)[primitive]->GetBoundingBox(aabb);
+	}
 
-		if (geometries.size() == 0)
-			return;
+	virtual void GetClippedPrimitiveBoundingBox(uint32_t primitive, const AABB& clip, AABB& aabb) const override
+	{
+		(*geometries)[primitive]->GetClippedBoundingBox(clip, aabb);
+	}
 
-		auto tempGeometries = geometries; // Create a modifiable array of the source scene objects
+	virtual GeometryType GetPrimitiveType(uint32_t primitive) const override
+	{
+		return (*geometries)[primitive]->GetType();
+	}
+
+private:
+	const std::vector<shared_ptr<Geometry>>*	geometries = nullptr;
+};
 
-		int axis = RandomInt(0, 2);
+// Builds a binary BVH over a shared array of primitive indices. Every node partitions its own range of the array
+// in place, so subtrees never overlap and can be built concurrently on the task scheduler.
+class BVHBuilder
+{
+public:
+	BVHBuilder(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) :
+		geometrySource(geometries),
+		source(geometrySource),
+		settings(settings),
+		nodeCount(0),
+		remainingDuplicates(0),
+		referenceCount(0)
+	{
+	}
+
+	// The source must outlive the builder.
+	BVHBuilder(const BVHPrimitiveSource& source, const BVHBuildSettings& settings) :
+		source(source),
+		settings(settings),
+		nodeCount(0),
+		remainingDuplicates(0),
+		referenceCount(0)
+	{
+	}
 
-		auto comparator = (axis == 0) ? BoxCompareX
-			: (axis == 1) ? BoxCompareY
-			: BoxCompareZ;
+	void Build()
+	{
+		const uint32_t primitiveCount = source.GetPrimitiveCount();
 
-		size_t count = end - start;
-		if (count == 1)
+		nodes.clear();
+		primitiveIndices.clear();
+		primitiveBounds.clear();
+		for (int axis = 0; axis < 3; axis++)
 		{
-			data.geometry = tempGeometries[start];
-			if (data.geometry)
-			{
-				data.geometry->GetBoundingBox(data.aabb);
-			}
+			primitiveCentroids[axis].clear();
+		}
+		primitiveTypes.clear();
+
+		if (primitiveCount == 0)
 			return;
+
+		// A tree with R references has at most 2R - 1 nodes, when every leaf holds a single one. That is one reference
+		// per primitive, plus the duplicates spatial splits are allowed to create.
+		uint32_t maxReferenceCount = primitiveCount;
+		if (settings.mode == BVHBuildMode::SBVH)
+			maxReferenceCount += static_cast<uint32_t>(primitiveCount * std::max<float>(settings.spatialSplitBudget, 0.0f));
+
+		nodes.resize(2 * maxReferenceCount - 1);
+		primitiveIndices.resize(maxReferenceCount);
+		primitiveBounds.resize(primitiveCount);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			primitiveCentroids[axis].resize(primitiveCount);
+		}
+		primitiveTypes.resize(primitiveCount);
+
+		if (settings.taskScheduler && primitiveCount >= settings.parallelThreshold)
+		{
+			enkiTaskSet* task = enkiCreateTaskSet(settings.taskScheduler, GatherBoundsJob);
+			enkiAddTaskSetMinRange(settings.taskScheduler, task, this, primitiveCount, settings.parallelThreshold);
+			enkiWaitForTaskSet(settings.taskScheduler, task);
+			enkiDeleteTaskSet(settings.taskScheduler, task);
+		}
+		else
+		{
+			GatherBoundsJob(0, primitiveCount, 0, this);
+		}
+
+		nodeCount = 1;
+
+		if (settings.mode == BVHBuildMode::LBVH)
+		{
+			BuildLBVH();
+		}
+		else if (settings.mode == BVHBuildMode::SBVH)
+		{
+			BuildSBVH(maxReferenceCount - primitiveCount);
 		}
-		else if (count == 2)
+		else
 		{
-			if (comparator(tempGeometries[start], tempGeometries[start + 1]))
+			BuildRecursive(0, 0, primitiveCount, 0);
+		}
+
+		nodes.resize(nodeCount);
+
+		SortLeavesByType();
+	}
+
+private:
+	static const uint32_t s_RadixTreeLeaf = 0x80000000;
+
+	// Internal node of the LBVH radix tree. Children are internal node indices, or sorted key indices when s_RadixTreeLeaf is set.
+	struct RadixTreeNode
+	{
+		uint32_t	left;
+		uint32_t	right;
+	};
+
+	struct SubtreeJob
+	{
+		BVHBuilder*	builder;
+		uint32_t	nodeIndex;
+		uint32_t	start;
+		uint32_t	end;
+		uint32_t	depth;
+	};
+
+	struct ReferenceSubtreeJob
+	{
+		BVHBuilder*					builder;
+		uint32_t					nodeIndex;
+		std::vector<BVHReference>*	references;
+		uint32_t					depth;
+	};
+
+	struct ObjectBin
+	{
+		AABB		aabb = AABB::Empty();
+		uint32_t	count = 0;
+	};
+
+	struct ObjectSplit
+	{
+		float		cost = infinity;
+		int			axis = -1;
+		uint32_t	bin = 0;
+		AABB		centroidBounds;
+		AABB		leftBounds;
+		AABB		rightBounds;
+	};
+
+	struct SpatialSplit
+	{
+		float		cost = infinity;
+		int			axis = -1;
+		uint32_t	bin = 0;		// References that end in this bin or before it go to the left.
+		float		position = 0.0f;
+		AABB		leftBounds;
+		AABB		rightBounds;
+		uint32_t	leftCount = 0;
+		uint32_t	rightCount = 0;
+	};
+
+	// The only pass over the primitives, the build itself reads the arrays filled here. SBVH spatial splits still clip primitives.
+	static void GatherBoundsJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		BVHBuilder& builder = *(BVHBuilder*)data;
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			AABB& aabb = builder.primitiveBounds[i];
+			builder.source.GetPrimitiveBoundingBox(i, aabb);
+
+			const Vector3f centroid = aabb.Center();
+			builder.primitiveCentroids[0][i] = centroid.x;
+			builder.primitiveCentroids[1][i] = centroid.y;
+			builder.primitiveCentroids[2][i] = centroid.z;
+
+			builder.primitiveTypes[i] = builder.source.GetPrimitiveType(i);
+			builder.primitiveIndices[i] = i;
+		}
+	}
+
+	static void BuildSubtreesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		SubtreeJob* jobs = (SubtreeJob*)data;
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			jobs[i].builder->BuildRecursive(jobs[i].nodeIndex, jobs[i].start, jobs[i].end, jobs[i].depth);
+		}
+	}
+
+	static void BuildReferenceSubtreesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		ReferenceSubtreeJob* jobs = (ReferenceSubtreeJob*)data;
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			jobs[i].builder->BuildSBVHRecursive(jobs[i].nodeIndex, *jobs[i].references, jobs[i].depth);
+		}
+	}
+
+	// Morton codes of the primitive centroids, quantized in the centroid bounds of the whole scene.
+	static void MortonCodesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		BVHBuilder& builder = *(BVHBuilder*)data;
+
+		const Vector3f origin = builder.centroidBounds.min;
+		const Vector3f extent = builder.centroidBounds.Extent();
+		const Vector3f invExtent(
+			extent.x > 0 ? 1.0f / extent.x : 0.0f,
+			extent.y > 0 ? 1.0f / extent.y : 0.0f,
+			extent.z > 0 ? 1.0f / extent.z : 0.0f);
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			Vector3f p = (builder.PrimitiveCentroid(i) - origin) * invExtent;
+			builder.mortonCodes[i] = (builder.settings.mortonCodeBits > 30) ? MortonCode63(p) : MortonCode30(p);
+		}
+	}
+
+	// Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees", 2012.
+	// Every internal node finds its own key range and split independently of the others.
+	static void RadixTreeJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		BVHBuilder& builder = *(BVHBuilder*)data;
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			const int64_t index = i;
+			const int64_t d = (builder.CommonPrefix(index, index + 1) - builder.CommonPrefix(index, index - 1)) >= 0 ? 1 : -1;
+
+			// Upper bound of the range length, then binary search for the other end.
+			const int deltaMin = builder.CommonPrefix(index, index - d);
+			int64_t lengthMax = 2;
+			while (builder.CommonPrefix(index, index + lengthMax * d) > deltaMin)
 			{
-				left = make_unique<BVHNode>(tempGeometries, start, start + 1);
-				right = make_unique<BVHNode>(tempGeometries, start + 1, start + 2);
+				lengthMax *= 2;
 			}
-			else
+
+			int64_t length = 0;
+			for (int64_t t = lengthMax / 2; t >= 1; t /= 2)
 			{
-				right = make_unique<BVHNode>(tempGeometries, start, start + 1);
-				left = make_unique<BVHNode>(tempGeometries, start + 1, start + 2);
+				if (builder.CommonPrefix(index, index + (length + t) * d) > deltaMin)
+				{
+					length += t;
+				}
 			}
+
+			const int64_t j = index + length * d;
+
+			// Binary search for the split position, the last key sharing more than deltaNode bits with the first one.
+			const int deltaNode = builder.CommonPrefix(index, j);
+			int64_t split = 0;
+			for (int64_t divisor = 2;; divisor *= 2)
+			{
+				int64_t t = (length + divisor - 1) / divisor;
+				if (builder.CommonPrefix(index, index + (split + t) * d) > deltaNode)
+				{
+					split += t;
+				}
+
+				if (t == 1)
+					break;
+			}
+
+			const int64_t gamma = index + split * d + std::min<int64_t>(d, 0);
+
+			RadixTreeNode& node = builder.radixTree[i];
+			node.left = static_cast<uint32_t>(gamma) | (std::min<int64_t>(index, j) == gamma ? s_RadixTreeLeaf : 0);
+			node.right = static_cast<uint32_t>(gamma + 1) | (std::max<int64_t>(index, j) == gamma + 1 ? s_RadixTreeLeaf : 0);
+		}
+	}
+
+	// Length of the common prefix of the sorted keys i and j, -1 outside of the key range.
+	// Duplicate keys are disambiguated by their position.
+	inline int CommonPrefix(int64_t i, int64_t j) const
+	{
+		if (j < 0 || j >= static_cast<int64_t>(mortonCodes.size()))
+			return -1;
+
+		uint64_t a = mortonCodes[i];
+		uint64_t b = mortonCodes[j];
+
+		if (a == b)
+			return 64 + CountLeadingZeros64(static_cast<uint64_t>(i ^ j));
+
+		return CountLeadingZeros64(a ^ b);
+	}
+
+	void RunJob(enkiTaskExecuteRange job, uint32_t count)
+	{
+		if (settings.taskScheduler && count >= settings.parallelThreshold)
+		{
+			enkiTaskSet* task = enkiCreateTaskSet(settings.taskScheduler, job);
+			enkiAddTaskSetMinRange(settings.taskScheduler, task, this, count, settings.parallelThreshold);
+			enkiWaitForTaskSet(settings.taskScheduler, task);
+			enkiDeleteTaskSet(settings.taskScheduler, task);
 		}
 		else
 		{
-			std::sort(tempGeometries.begin() + start, tempGeometries.begin() + end, comparator);
+			job(0, count, 0, this);
+		}
+	}
 
-			size_t mid = start + count / 2;
-			left = make_unique<BVHNode>(tempGeometries, start, mid);
-			right = make_unique<BVHNode>(tempGeometries, mid, end);
+	void BuildLBVH()
+	{
+		const uint32_t primitiveCount = static_cast<uint32_t>(primitiveIndices.size());
+
+		centroidBounds = AABB::Empty();
+		for (uint32_t i = 0; i < primitiveCount; i++)
+		{
+			centroidBounds.Encapsulate(PrimitiveCentroid(i));
 		}
 
+		mortonCodes.resize(primitiveCount);
+		RunJob(MortonCodesJob, primitiveCount);
 
-		AABB boxLeft;
-		AABB boxRight;
+		RadixSort::Sort(mortonCodes, primitiveIndices, (settings.mortonCodeBits > 30) ? 63 : 30, settings.taskScheduler);
 
-		if (left->data.geometry)
+		if (primitiveCount == 1)
 		{
-			left->data.geometry->GetBoundingBox(boxLeft);
+			EmitLBVH(0 | s_RadixTreeLeaf, 0, 0, 0, 0);
 		}
 		else
 		{
-			boxLeft = left->data.aabb;
+			radixTree.resize(primitiveCount - 1);
+			RunJob(RadixTreeJob, primitiveCount - 1);
+
+			EmitLBVH(0, 0, 0, primitiveCount - 1, 0);
 		}
 
-		if (right->data.geometry)
+		mortonCodes = std::vector<uint64_t>();
+		radixTree = std::vector<RadixTreeNode>();
+	}
+
+	// Converts the radix tree to build nodes with adjacent siblings and computes their bounds bottom-up.
+	// Subtrees covering the sorted keys [first, last] collapse into a leaf once they fit in one. From
+	// s_BVHMedianSplitDepth on, the radix tree is no longer followed and the keys are split in the middle instead.
+	void EmitLBVH(uint32_t radixNode, uint32_t nodeIndex, uint32_t first, uint32_t last, uint32_t depth)
+	{
+		BVHBuildNode& node = nodes[nodeIndex];
+
+		if ((radixNode & s_RadixTreeLeaf) || last - first < MaxLeafSize())
+		{
+			node.aabb = AABB::Empty();
+			for (uint32_t i = first; i <= last; i++)
+			{
+				node.aabb.Encapsulate(primitiveBounds[primitiveIndices[i]]);
+			}
+
+			node.offset = first;
+			node.primitiveCount = last - first + 1;
+			return;
+		}
+
+		const uint32_t childIndex = nodeCount.fetch_add(2);
+		node.offset = childIndex;
+		node.primitiveCount = 0;
+
+		// The left child ends at the split key gamma, whether it is a key or an internal node.
+		uint32_t left = 0;
+		uint32_t right = 0;
+		uint32_t gamma = first + (last - first) / 2;
+		if (depth < s_BVHMedianSplitDepth)
+		{
+			left = radixTree[radixNode].left;
+			right = radixTree[radixNode].right;
+			gamma = left & ~s_RadixTreeLeaf;
+		}
+
+		EmitLBVH(left, childIndex, first, gamma, depth + 1);
+		EmitLBVH(right, childIndex + 1, gamma + 1, last, depth + 1);
+
+		AABB aabb = nodes[childIndex].aabb;
+		aabb.Encapsulate(nodes[childIndex + 1].aabb);
+		nodes[nodeIndex].aabb = aabb;
+	}
+
+	// Stich et al., "Spatial Splits in Bounding Volume Hierarchies", 2009.
+	// Every node chooses between the best binned object split and the best spatial split, which cuts the references
+	// straddling a plane into two clipped references. Spatial splits stop once duplicateBudget references were added.
+	void BuildSBVH(uint32_t duplicateBudget)
+	{
+		const uint32_t primitiveCount = source.GetPrimitiveCount();
+
+		std::vector<BVHReference> references(primitiveCount);
+		AABB rootBounds = AABB::Empty();
+		for (uint32_t i = 0; i < primitiveCount; i++)
+		{
+			references[i].aabb = primitiveBounds[i];
+			references[i].primitive = i;
+			rootBounds.Encapsulate(primitiveBounds[i]);
+		}
+
+		rootSurfaceArea = rootBounds.SurfaceArea();
+		remainingDuplicates = duplicateBudget;
+		referenceCount = 0;
+
+		BuildSBVHRecursive(0, references, 0);
+
+		primitiveIndices.resize(referenceCount);
+	}
+
+	void BuildSBVHRecursive(uint32_t nodeIndex, std::vector<BVHReference>& references, uint32_t depth)
+	{
+		BVHBuildNode& node = nodes[nodeIndex];
+
+		node.aabb = AABB::Empty();
+		for (const BVHReference& reference : references)
+		{
+			node.aabb.Encapsulate(reference.aabb);
+		}
+
+		const uint32_t count = static_cast<uint32_t>(references.size());
+		const float leafCost = (count <= MaxLeafSize()) ? settings.intersectionCost * count : infinity;
+
+		std::vector<BVHReference> left;
+		std::vector<BVHReference> right;
+
+		if (depth >= s_BVHMedianSplitDepth && count > MaxLeafSize())
 		{
-			right->data.geometry->GetBoundingBox(boxRight);
+			SplitReferencesMedian(references, left, right);
+		}
+		else if (count == 1 || depth >= s_BVHMedianSplitDepth || !SplitReferences(node.aabb, references, leafCost, left, right))
+		{
+			const uint32_t slot = referenceCount.fetch_add(count);
+			for (uint32_t i = 0; i < count; i++)
+			{
+				primitiveIndices[slot + i] = references[i].primitive;
+			}
+
+			node.offset = slot;
+			node.primitiveCount = count;
+			return;
+		}
+
+		// The children own copies of the references from here on.
+		references = std::vector<BVHReference>();
+
+		const uint32_t childIndex = nodeCount.fetch_add(2);
+		node.offset = childIndex;
+		node.primitiveCount = 0;
+
+		if (settings.taskScheduler && count >= settings.parallelThreshold)
+		{
+			ReferenceSubtreeJob jobs[2] =
+			{
+				{ this, childIndex, &left, depth + 1 },
+				{ this, childIndex + 1, &right, depth + 1 },
+			};
+
+			enkiTaskSet* task = enkiCreateTaskSet(settings.taskScheduler, BuildReferenceSubtreesJob);
+			enkiAddTaskSetMinRange(settings.taskScheduler, task, jobs, 2, 1);
+			enkiWaitForTaskSet(settings.taskScheduler, task);
+			enkiDeleteTaskSet(settings.taskScheduler, task);
 		}
 		else
 		{
-			boxRight = right->data.aabb;
+			BuildSBVHRecursive(childIndex, left, depth + 1);
+			BuildSBVHRecursive(childIndex + 1, right, depth + 1);
 		}
-		
-		boxLeft.Encapsulate(boxRight);
-		data.aabb = boxLeft;
+
+		AABB aabb = nodes[childIndex].aabb;
+		aabb.Encapsulate(nodes[childIndex + 1].aabb);
+		nodes[nodeIndex].aabb = aabb;
 	}
 
-	~BVHNode()
+	// Same as PartitionMedian for references: splits them in two halves along a random axis, by the min corner of their bounds.
+	void SplitReferencesMedian(std::vector<BVHReference>& references, std::vector<BVHReference>& left, std::vector<BVHReference>& right)
 	{
-		s_BVHNodeCount--;
+		const int axis = RandomInt(0, 2);
+		const auto mid = references.begin() + references.size() / 2;
+
+		std::nth_element(references.begin(), mid, references.end(), [axis](const BVHReference& a, const BVHReference& b)
+		{
+			return a.aabb.min[axis] < b.aabb.min[axis];
+		});
+
+		left.assign(references.begin(), mid);
+		right.assign(mid, references.end());
 	}
 
-	inline bool Hit(RayDesc& rayDesc, HitDesc& hitDesc) const
+	// Distributes the references of a node over its two children, both of which end up non-empty. Returns false,
+	// leaving left and right empty, if no split is cheaper than leafCost.
+	bool SplitReferences(const AABB& bounds, const std::vector<BVHReference>& references, float leafCost, std::vector<BVHReference>& left, std::vector<BVHReference>& right)
 	{
-		if (data.aabb.Hit(rayDesc))
+		const uint32_t binCount = std::min<uint32_t>(std::max<uint32_t>(settings.binCount, 2), s_BVHMaxBinCount);
+		const float invArea = 1.0f / bounds.SurfaceArea();
+
+		ObjectSplit objectSplit;
+		FindObjectSplit(references, binCount, invArea, objectSplit);
+
+		// Spatial splits only pay off where the object split leaves children that overlap, typically around large primitives.
+		AABB overlap = objectSplit.leftBounds;
+		overlap.Clip(objectSplit.rightBounds);
+		const bool overlapping = (objectSplit.axis == -1) || (!overlap.IsEmpty() && overlap.SurfaceArea() > settings.spatialSplitAlpha * rootSurfaceArea);
+
+		SpatialSplit spatialSplit;
+		if (overlapping && remainingDuplicates.load() > 0)
+			FindSpatialSplit(bounds, references, binCount, invArea, spatialSplit);
+
+		if (leafCost <= std::min<float>(objectSplit.cost, spatialSplit.cost))
+			return false;
+
+		if (spatialSplit.cost < objectSplit.cost && PerformSpatialSplit(bounds, references, binCount, spatialSplit, left, right))
+			return true;
+
+		if (objectSplit.axis != -1)
+		{
+			const int axis = objectSplit.axis;
+			const float axisMin = objectSplit.centroidBounds.min[axis];
+			const float scale = binCount / (objectSplit.centroidBounds.max[axis] - axisMin);
+
+			for (const BVHReference& reference : references)
+			{
+				const uint32_t b = ObjectBinIndex(reference.aabb.Center()[axis], axisMin, scale, binCount);
+				(b <= objectSplit.bin ? left : right).push_back(reference);
+			}
+		}
+		else
+		{
+			// All centroids are in the same place, any split is as good as another.
+			const size_t mid = references.size() / 2;
+			left.assign(references.begin(), references.begin() + mid);
+			right.assign(references.begin() + mid, references.end());
+		}
+
+		return true;
+	}
+
+	// Same binned SAH as PartitionSAH, over reference bounds. Clipped references have centroids of their own.
+	void FindObjectSplit(const std::vector<BVHReference>& references, uint32_t binCount, float invArea, ObjectSplit& split)
+	{
+		split.centroidBounds = AABB::Empty();
+		for (const BVHReference& reference : references)
+		{
+			split.centroidBounds.Encapsulate(reference.aabb.Center());
+		}
+
+		for (int axis = 0; axis < 3; axis++)
 		{
-			if (data.geometry)
+			float axisMin, scale;
+			if (!BinScale(split.centroidBounds, axis, binCount, axisMin, scale))
+				continue;
+
+			ObjectBin bins[s_BVHMaxBinCount];
+
+			for (const BVHReference& reference : references)
 			{
-				// Leaf node - check geometry intersection.
-				bool hit = data.geometry->Hit(rayDesc, hitDesc);
-				if (hit)
+				ObjectBin& bin = bins[ObjectBinIndex(reference.aabb.Center()[axis], axisMin, scale, binCount)];
+				bin.aabb.Encapsulate(reference.aabb);
+				bin.count++;
+			}
+
+			EvaluateObjectBins(bins, binCount, axis, invArea, split);
+		}
+	}
+
+	// Bins are laid over the centroid bounds of a node. Returns false if all centroids are in the same place along the axis.
+	static inline bool BinScale(const AABB& centroidBounds, int axis, uint32_t binCount, float& axisMin, float& scale)
+	{
+		axisMin = centroidBounds.min[axis];
+
+		const float axisMax = centroidBounds.max[axis];
+		if (axisMax <= axisMin)
+			return false;
+
+		scale = binCount / (axisMax - axisMin);
+		return true;
+	}
+
+	static inline uint32_t ObjectBinIndex(float centroid, float axisMin, float scale, uint32_t binCount)
+	{
+		return std::min<uint32_t>(static_cast<uint32_t>((centroid - axisMin) * scale), binCount - 1);
+	}
+
+	// Sweeps the bins of one axis from the right to accumulate the cost of every right-hand side, then from the left to
+	// evaluate each split plane. Replaces split if a plane is cheaper than split.cost.
+	void EvaluateObjectBins(const ObjectBin* bins, uint32_t binCount, int axis, float invArea, ObjectSplit& split) const
+	{
+		float rightArea[s_BVHMaxBinCount];
+		uint32_t rightCount[s_BVHMaxBinCount];
+
+		AABB accumulated = AABB::Empty();
+		uint32_t count = 0;
+		for (uint32_t b = binCount - 1; b > 0; b--)
+		{
+			accumulated.Encapsulate(bins[b].aabb);
+			count += bins[b].count;
+			rightArea[b] = accumulated.SurfaceArea();
+			rightCount[b] = count;
+		}
+
+		// Kept in locals, stores to split could alias the bins.
+		float bestCost = split.cost;
+		uint32_t bestBin = binCount;
+
+		accumulated = AABB::Empty();
+		count = 0;
+		for (uint32_t b = 0; b < binCount - 1; b++)
+		{
+			accumulated.Encapsulate(bins[b].aabb);
+			count += bins[b].count;
+
+			if (count == 0 || rightCount[b + 1] == 0)
+				continue;
+
+			float cost = settings.traversalCost + settings.intersectionCost * invArea * (count * accumulated.SurfaceArea() + rightCount[b + 1] * rightArea[b + 1]);
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestBin = b;
+			}
+		}
+
+		if (bestBin == binCount)
+			return;
+
+		split.cost = bestCost;
+		split.axis = axis;
+		split.bin = bestBin;
+		split.leftBounds = AABB::Empty();
+		split.rightBounds = AABB::Empty();
+		for (uint32_t b = 0; b < binCount; b++)
+		{
+			(b <= bestBin ? split.leftBounds : split.rightBounds).Encapsulate(bins[b].aabb);
+		}
+	}
+
+	static inline uint32_t SpatialBin(float position, float axisMin, float scale, uint32_t binCount)
+	{
+		return std::min<uint32_t>(static_cast<uint32_t>(std::max<float>((position - axisMin) * scale, 0.0f)), binCount - 1);
+	}
+
+	// Bins the references by the slabs they overlap, growing each bin by the clipped bounds of the part inside it.
+	// References are counted on the left of a plane from the bin they enter and on the right up to the bin they exit.
+	void FindSpatialSplit(const AABB& bounds, const std::vector<BVHReference>& references, uint32_t binCount, float invArea, SpatialSplit& split)
+	{
+		struct Bin
+		{
+			AABB		aabb = AABB::Empty();
+			uint32_t	entryCount = 0;
+			uint32_t	exitCount = 0;
+		};
+
+		const uint32_t count = static_cast<uint32_t>(references.size());
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float axisMin = bounds.min[axis];
+			const float axisMax = bounds.max[axis];
+
+			if (axisMax <= axisMin)
+				continue;
+
+			const float binWidth = (axisMax - axisMin) / binCount;
+			const float scale = binCount / (axisMax - axisMin);
+
+			Bin bins[s_BVHMaxBinCount];
+
+			for (const BVHReference& reference : references)
+			{
+				const uint32_t first = SpatialBin(reference.aabb.min[axis], axisMin, scale, binCount);
+				const uint32_t last = SpatialBin(reference.aabb.max[axis], axisMin, scale, binCount);
+
+				if (first == last)
 				{
-					rayDesc.tmax = hitDesc.t;
+					bins[first].aabb.Encapsulate(reference.aabb);
+				}
+				else
+				{
+					AABB remaining = reference.aabb;
+					for (uint32_t b = first; b <= last; b++)
+					{
+						AABB clip = remaining;
+						if (b < last)
+							clip.max[axis] = axisMin + (b + 1) * binWidth;
+
+						AABB part;
+						source.GetClippedPrimitiveBoundingBox(reference.primitive, clip, part);
+						if (!part.IsEmpty())
+						{
+							part.Clip(reference.aabb);
+							bins[b].aabb.Encapsulate(part);
+						}
+
+						remaining.min[axis] = clip.max[axis];
+					}
 				}
-				return hit;
+
+				bins[first].entryCount++;
+				bins[last].exitCount++;
 			}
-			else
+
+			AABB rightBounds[s_BVHMaxBinCount];
+			uint32_t rightCount[s_BVHMaxBinCount];
+
+			AABB accumulated = AABB::Empty();
+			uint32_t exitCount = 0;
+			for (uint32_t b = binCount - 1; b > 0; b--)
+			{
+				accumulated.Encapsulate(bins[b].aabb);
+				exitCount += bins[b].exitCount;
+				rightBounds[b] = accumulated;
+				rightCount[b] = exitCount;
+			}
+
+			accumulated = AABB::Empty();
+			uint32_t entryCount = 0;
+			for (uint32_t b = 0; b < binCount - 1; b++)
+			{
+				accumulated.Encapsulate(bins[b].aabb);
+				entryCount += bins[b].entryCount;
+
+				// Both children must get fewer references than the node, otherwise the recursion would not terminate.
+				if (entryCount == 0 || rightCount[b + 1] == 0 || entryCount == count || rightCount[b + 1] == count)
+					continue;
+
+				float cost = settings.traversalCost + settings.intersectionCost * invArea * (entryCount * accumulated.SurfaceArea() + rightCount[b + 1] * rightBounds[b + 1].SurfaceArea());
+				if (cost < split.cost)
+				{
+					split.cost = cost;
+					split.axis = axis;
+					split.bin = b;
+					split.position = axisMin + (b + 1) * binWidth;
+					split.leftBounds = accumulated;
+					split.rightBounds = rightBounds[b + 1];
+					split.leftCount = entryCount;
+					split.rightCount = rightCount[b + 1];
+				}
+			}
+		}
+	}
+
+	// Returns false, leaving left and right empty, if the duplicate budget is exhausted or the split ends up one-sided.
+	bool PerformSpatialSplit(const AABB& bounds, const std::vector<BVHReference>& references, uint32_t binCount, const SpatialSplit& split, std::vector<BVHReference>& left, std::vector<BVHReference>& right)
+	{
+		// Reserve the worst case, every straddling reference being duplicated, and give back what is not used.
+		const uint32_t straddling = split.leftCount + split.rightCount - static_cast<uint32_t>(references.size());
+
+		uint32_t remaining = remainingDuplicates.load();
+		do
+		{
+			if (remaining < straddling)
+				return false;
+		} while (!remainingDuplicates.compare_exchange_weak(remaining, remaining - straddling));
+
+		// References are classified with the same bins as in FindSpatialSplit, so exactly split.leftCount + split.rightCount
+		// minus the reference count straddle the plane.
+		const int axis = split.axis;
+		const float axisMin = bounds.min[axis];
+		const float scale = binCount / (bounds.max[axis] - axisMin);
+
+		AABB leftBounds = split.leftBounds;
+		AABB rightBounds = split.rightBounds;
+		uint32_t leftCount = split.leftCount;
+		uint32_t rightCount = split.rightCount;
+		uint32_t duplicates = 0;
+
+		for (const BVHReference& reference : references)
+		{
+			if (SpatialBin(reference.aabb.max[axis], axisMin, scale, binCount) <= split.bin)
 			{
-				bool hitLeft = left->Hit(rayDesc, hitDesc);
-				bool hitRight = right->Hit(rayDesc, hitDesc);
+				left.push_back(reference);
+				continue;
+			}
 
-				return hitLeft || hitRight;
+			if (SpatialBin(reference.aabb.min[axis], axisMin, scale, binCount) > split.bin)
+			{
+				right.push_back(reference);
+				continue;
 			}
+
+			// Reference unsplitting: moving the whole reference to one side can be cheaper than duplicating it.
+			AABB leftUnsplit = leftBounds;
+			leftUnsplit.Encapsulate(reference.aabb);
+			AABB rightUnsplit = rightBounds;
+			rightUnsplit.Encapsulate(reference.aabb);
+
+			const float splitCost = leftBounds.SurfaceArea() * leftCount + rightBounds.SurfaceArea() * rightCount;
+			const float leftCost = leftUnsplit.SurfaceArea() * leftCount + rightBounds.SurfaceArea() * (rightCount - 1);
+			const float rightCost = leftBounds.SurfaceArea() * (leftCount - 1) + rightUnsplit.SurfaceArea() * rightCount;
+
+			if (leftCost < splitCost && leftCost <= rightCost)
+			{
+				left.push_back(reference);
+				leftBounds = leftUnsplit;
+				rightCount--;
+				continue;
+			}
+
+			if (rightCost < splitCost)
+			{
+				right.push_back(reference);
+				rightBounds = rightUnsplit;
+				leftCount--;
+				continue;
+			}
+
+			BVHReference leftReference = reference;
+			BVHReference rightReference = reference;
+			AABB leftClip = reference.aabb;
+			AABB rightClip = reference.aabb;
+			leftClip.max[axis] = split.position;
+			rightClip.min[axis] = split.position;
+
+			source.GetClippedPrimitiveBoundingBox(reference.primitive, leftClip, leftReference.aabb);
+			source.GetClippedPrimitiveBoundingBox(reference.primitive, rightClip, rightReference.aabb);
+			leftReference.aabb.Clip(leftClip);
+			rightReference.aabb.Clip(rightClip);
+
+			const bool leftEmpty = leftReference.aabb.IsEmpty();
+			const bool rightEmpty = rightReference.aabb.IsEmpty();
+
+			if (leftEmpty && rightEmpty)
+			{
+				// Only rounding gets here, keep the reference as it is.
+				left.push_back(reference);
+				continue;
+			}
+
+			if (!leftEmpty)
+				left.push_back(leftReference);
+			if (!rightEmpty)
+				right.push_back(rightReference);
+			if (!leftEmpty && !rightEmpty)
+				duplicates++;
+		}
+
+		if (left.empty() || right.empty())
+		{
+			left.clear();
+			right.clear();
+			duplicates = 0;
+		}
+
+		remainingDuplicates.fetch_add(straddling - duplicates);
+
+		return !left.empty();
+	}
+
+	inline uint32_t MaxLeafSize() const
+	{
+		return std::min<uint32_t>(std::max<uint32_t>(settings.maxLeafSize, 1), s_BVHMaxLeafSize);
+	}
+
+	// Leaves test their primitives in storage order, grouping them by type lets the leaf tests handle each type in one run.
+	// Lazy subtrees are left alone, their own build sorts their leaves.
+	void SortLeavesByType()
+	{
+		for (const BVHBuildNode& node : nodes)
+		{
+			if (node.primitiveCount < 2 || node.primitiveCount > s_BVHMaxLeafSize)
+				continue;
+
+			std::stable_sort(primitiveIndices.begin() + node.offset, primitiveIndices.begin() + node.offset + node.primitiveCount, [&](uint32_t a, uint32_t b)
+			{
+				return primitiveTypes[a] < primitiveTypes[b];
+			});
+		}
+	}
+
+	static inline int RandomInt(int min, int max)
+	{
+		// Returns a random integer in [min,max].
+		return static_cast<int>(RandomFloat((float)min, (float)(max + 1)));
+	}
+
+	void BuildRecursive(uint32_t nodeIndex, uint32_t start, uint32_t end, uint32_t depth)
+	{
+		BVHBuildNode& node = nodes[nodeIndex];
+
+		node.aabb = AABB::Empty();
+		for (uint32_t i = start; i < end; i++)
+		{
+			node.aabb.Encapsulate(primitiveBounds[i]);
+		}
+
+		const uint32_t count = end - start;
+
+		// Lazy builds stop here, LazyBVH builds the rest of the subtree on first traversal.
+		if (lazySubtrees && count > s_BVHMaxLeafSize && count <= settings.lazySubtreeSize)
+		{
+			node.offset = start;
+			node.primitiveCount = count;
+			return;
+		}
+
+		const bool fitsInLeaf = count <= MaxLeafSize();
+
+		uint32_t mid = 0;
+		bool split = false;
+
+		if (count > 1 && settings.mode == BVHBuildMode::SAH && depth < s_BVHMedianSplitDepth)
+			split = PartitionSAH(node.aabb, start, end, fitsInLeaf ? settings.intersectionCost * count : infinity, mid);
+
+		if (!split && fitsInLeaf)
+		{
+			node.offset = start;
+			node.primitiveCount = count;
+			return;
+		}
+
+		if (!split)
+		{
+			PartitionMedian(start, end, mid);
+		}
+
+		// Allocate both children together so that siblings are adjacent.
+		const uint32_t childIndex = nodeCount.fetch_add(2);
+		node.offset = childIndex;
+		node.primitiveCount = 0;
+
+		if (settings.taskScheduler && count >= settings.parallelThreshold)
+		{
+			SubtreeJob jobs[2] =
+			{
+				{ this, childIndex, start, mid, depth + 1 },
+				{ this, childIndex + 1, mid, end, depth + 1 },
+			};
+
+			enkiTaskSet* task = enkiCreateTaskSet(settings.taskScheduler, BuildSubtreesJob);
+			enkiAddTaskSetMinRange(settings.taskScheduler, task, jobs, 2, 1);
+			enkiWaitForTaskSet(settings.taskScheduler, task);
+			enkiDeleteTaskSet(settings.taskScheduler, task);
 		}
 		else
-			return false;
+		{
+			BuildRecursive(childIndex, start, mid, depth + 1);
+			BuildRecursive(childIndex + 1, mid, end, depth + 1);
+		}
+
+		AABB aabb = nodes[childIndex].aabb;
+		aabb.Encapsulate(nodes[childIndex + 1].aabb);
+		nodes[nodeIndex].aabb = aabb;
 	}
 
-	inline void Clear()
+	// Splits [start, end) at the median primitive along a random axis, ordering primitives by the min corner of their bounds.
+	// Quickselect over the build order arrays, moving bounds and centroids along with the indices.
+	void PartitionMedian(uint32_t start, uint32_t end, uint32_t& mid)
 	{
-		if (left)
-			left->Clear();
+		const int axis = RandomInt(0, 2);
+
+		mid = start + (end - start) / 2;
 
-		if (right)
-			right->Clear();
+		uint32_t first = start;
+		uint32_t last = end - 1;
 
-		left.reset();
-		right.reset();
+		while (first < last)
+		{
+			const float pivot = primitiveBounds[first + (last - first) / 2].min[axis];
+
+			uint32_t i = first;
+			uint32_t j = last;
+			while (i <= j)
+			{
+				while (primitiveBounds[i].min[axis] < pivot)
+				{
+					i++;
+				}
+				while (primitiveBounds[j].min[axis] > pivot)
+				{
+					j--;
+				}
+				if (i <= j)
+				{
+					SwapPrimitives(i, j);
+					i++;
+					if (j == 0)
+						break;
+					j--;
+				}
+			}
+
+			if (mid <= j)
+				last = j;
+			else if (mid >= i)
+				first = i;
+			else
+				break;
+		}
+	}
+
+	inline void SwapPrimitives(uint32_t a, uint32_t b)
+	{
+		std::swap(primitiveIndices[a], primitiveIndices[b]);
+		std::swap(primitiveBounds[a], primitiveBounds[b]);
+		std::swap(primitiveCentroids[0][a], primitiveCentroids[0][b]);
+		std::swap(primitiveCentroids[1][a], primitiveCentroids[1][b]);
+		std::swap(primitiveCentroids[2][a], primitiveCentroids[2][b]);
+	}
+
+	// Finds the cheapest binned SAH split of [start, end) and partitions the primitives around it. Returns false if all
+	// centroids fall in the same bin or no split is cheaper than leafCost, in which case nothing is reordered.
+	bool PartitionSAH(const AABB& bounds, uint32_t start, uint32_t end, float leafCost, uint32_t& mid)
+	{
+		ObjectSplit split;
+		split.cost = leafCost;
+
+		split.centroidBounds = AABB::Empty();
+		for (uint32_t i = start; i < end; i++)
+		{
+			split.centroidBounds.Encapsulate(PrimitiveCentroid(i));
+		}
+
+		const float invArea = 1.0f / bounds.SurfaceArea();
+
+		const uint32_t binCount = std::min<uint32_t>(std::max<uint32_t>(settings.binCount, 2), s_BVHMaxBinCount);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float axisMin, scale;
+			if (!BinScale(split.centroidBounds, axis, binCount, axisMin, scale))
+				continue;
+
+			const float* centroids = primitiveCentroids[axis].data();
+
+			ObjectBin bins[s_BVHMaxBinCount];
+
+			for (uint32_t i = start; i < end; i++)
+			{
+				ObjectBin& bin = bins[ObjectBinIndex(centroids[i], axisMin, scale, binCount)];
+				bin.aabb.Encapsulate(primitiveBounds[i]);
+				bin.count++;
+			}
+
+			EvaluateObjectBins(bins, binCount, axis, invArea, split);
+		}
+
+		if (split.axis == -1)
+			return false;
+
+		const float* centroids = primitiveCentroids[split.axis].data();
+		const float axisMin = split.centroidBounds.min[split.axis];
+		const float scale = binCount / (split.centroidBounds.max[split.axis] - axisMin);
+
+		auto isLeft = [&](uint32_t i)
+		{
+			return ObjectBinIndex(centroids[i], axisMin, scale, binCount) <= split.bin;
+		};
+
+		uint32_t left = start;
+		uint32_t right = end;
+		while (true)
+		{
+			while (left < right && isLeft(left))
+			{
+				left++;
+			}
+			while (left < right && !isLeft(right - 1))
+			{
+				right--;
+			}
+			if (left == right)
+				break;
+
+			SwapPrimitives(left++, --right);
+		}
+
+		mid = left;
+
+		return true;
+	}
+
+	inline Vector3f PrimitiveCentroid(uint32_t primitive) const
+	{
+		return Vector3f(primitiveCentroids[0][primitive], primitiveCentroids[1][primitive], primitiveCentroids[2][primitive]);
 	}
 
 public:
-	unique_ptr<BVHNode> left;
-	unique_ptr<BVHNode> right;
-	Data				data;
+	std::vector<BVHBuildNode>	nodes;				// nodes[0] is the root.
+	std::vector<uint32_t>		primitiveIndices;	// Primitives of the source, ordered so that each leaf references a contiguous range.
+
+	// Stops splitting at BVHBuildSettings::lazySubtreeSize primitives, leaving leaves larger than s_BVHMaxLeafSize.
+	// Only LazyBVH sets it, since only it can traverse such leaves, other builds ignore lazySubtreeSize.
+	bool						lazySubtrees = false;
+
+private:
+	GeometryPrimitiveSource		geometrySource;	// Only used when building over geometries.
+	const BVHPrimitiveSource&	source;
+	const BVHBuildSettings&		settings;
+
+	// Gathered once by GatherBoundsJob, the build never calls the source after that. SAH and median builds keep
+	// bounds and centroids in the order of primitiveIndices, so every node reads its primitives sequentially.
+	// Bounds are only ever read whole, to grow nodes and bins, while centroids are read one axis at a time.
+	// Types stay indexed by primitive.
+	std::vector<AABB>			primitiveBounds;
+	std::vector<float>			primitiveCentroids[3];
+	std::vector<GeometryType>	primitiveTypes;
+
+	std::atomic<uint32_t>	nodeCount;
+
+	// SBVH only.
+	float					rootSurfaceArea = 0.0f;
+	std::atomic<uint32_t>	remainingDuplicates;
+	std::atomic<uint32_t>	referenceCount;
+
+	// LBVH only.
+	AABB						centroidBounds;
+	std::vector<uint64_t>		mortonCodes;
+	std::vector<RadixTreeNode>	radixTree;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,336 @@
+#ifndef BVH_ACCELERATION_STRUCTURE_H
+#define BVH_ACCELERATION_STRUCTURE_H
+
+#include <vector>
+#include <memory>
+
+#include "AccelerationStructure.h"
+#include "BVHSerialization.h"
+#include "BVHStats.h"
+#include "LazyBVH.h"
+#include "LinearBVH.h"
+#include "QuantizedBVH.h"
+#include "StacklessBVH.h"
+#include "WideBVH.h"
+
+// The binary BVH and the layout rays traverse, built from it. Lazy builds, see BVHBuildSettings::lazySubtreeSize,
+// replace both with a LazyBVH. The quantized layout releases the binary nodes and unpacks them again when needed.
+class BVHAccelerationStructure : public AccelerationStructure
+{
+public:
+	virtual AccelerationStructureType GetType() const override
+	{
+		return AccelerationStructureType::BVH;
+	}
+
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) override
+	{
+		buildSettings = settings;
+
+		if (settings.lazySubtreeSize > s_BVHMaxLeafSize)
+		{
+			Clear();
+			lazyBVH.Build(geometries, settings);
+			lazy = true;
+			return;
+		}
+
+		lazy = false;
+		lazyBVH.Clear();
+
+		bvh.Build(geometries, settings);
+
+		if (settings.nodeOrder != BVHNodeOrder::DepthFirst)
+			bvh.Reorder(settings.nodeOrder, settings.hotVisitFraction);
+
+		SetLayout(settings.layout);
+		BuildDerivedLayout();
+
+		mappedFile.reset();
+	}
+
+	virtual void Clear() override
+	{
+		bvh.Clear();
+		bvh4.Clear();
+#if WIDE_BVH8_SUPPORTED
+		bvh8.Clear();
+#endif
+		quantizedBVH.Clear();
+		stacklessBVH.Clear();
+		lazyBVH.Clear();
+		lazy = false;
+		binaryNodesReleased = false;
+		mappedFile.reset();
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		if (lazy)
+			return lazyBVH.Hit(rayDesc, hitDesc);
+
+		switch (layout)
+		{
+		case BVHLayout::Wide4:
+			return bvh4.Hit(rayDesc, hitDesc);
+#if WIDE_BVH8_SUPPORTED
+		case BVHLayout::Wide8:
+			return bvh8.Hit(rayDesc, hitDesc);
+#endif
+		case BVHLayout::Quantized:
+			return quantizedBVH.Hit(rayDesc, hitDesc);
+		case BVHLayout::Stackless:
+			return stacklessBVH.Hit(rayDesc, hitDesc);
+		default:
+			return bvh.Hit(rayDesc, hitDesc);
+		}
+	}
+
+	// Refits the node bounds in place, unless refitting has degraded the tree too much for the last build settings.
+	virtual bool Refit() override
+	{
+		// Subtrees that are not built yet cannot be refitted.
+		if (lazy)
+			return false;
+
+		UnpackBinaryNodes();
+
+		if (bvh.nodes.empty())
+			return true;
+
+		bvh.Refit();
+
+		if (bvh.ComputeSAHCost(buildSettings.traversalCost, buildSettings.intersectionCost) > buildSettings.refitRebuildThreshold * bvh.builtSAHCost)
+			return false;
+
+		if (layout == BVHLayout::Wide4)
+			bvh4.Refit();
+#if WIDE_BVH8_SUPPORTED
+		else if (layout == BVHLayout::Wide8)
+			bvh8.Refit();
+#endif
+		else if (layout == BVHLayout::Quantized)
+			BuildQuantizedLayout();	// Requantizing is a linear pass, as cheap as a refit.
+		else if (layout == BVHLayout::Stackless)
+			stacklessBVH.Build(bvh);
+
+		return true;
+	}
+
+	virtual size_t GetMemorySize() const override
+	{
+		return bvh.nodes.size() * sizeof(LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t) + GetLayoutMemorySize();
+	}
+
+	// Starts counting node visits for BVHNodeOrder::VisitCount, typically followed by a low resolution profiling render.
+	// Rays traverse the binary layout until EndProfiling.
+	void BeginProfiling()
+	{
+		UnpackBinaryNodes();
+		bvh.BeginProfiling();
+		layout = BVHLayout::Binary;
+	}
+
+	// Packs the nodes visited most during profiling at the front of the node array, then collapses the wide layout again.
+	void EndProfiling()
+	{
+		bvh.Reorder(BVHNodeOrder::VisitCount, buildSettings.hotVisitFraction);
+
+		SetLayout(buildSettings.layout);
+		BuildDerivedLayout();
+	}
+
+	// Writes the BVH to a file that Load can map later for the same geometries.
+	bool Save(const char* path, const std::vector<shared_ptr<Geometry>>& geometries) const
+	{
+		if (lazy || (bvh.nodes.empty() && !binaryNodesReleased))
+			return false;
+
+		const uint64_t sceneHash = ComputeSceneHash(geometries);
+
+		if (binaryNodesReleased)
+		{
+			LinearBVH unpacked;
+			quantizedBVH.Unpack(unpacked.nodes);
+			unpacked.primitiveIndices.Attach(bvh.primitiveIndices.data(), bvh.primitiveIndices.size());
+			unpacked.builtSAHCost = bvh.builtSAHCost;
+			return SaveBVH(path, sceneHash, unpacked, 0, nullptr, 0, 0);
+		}
+
+		if (layout == BVHLayout::Wide4)
+			return SaveBVH(path, sceneHash, bvh, 4, bvh4.nodes.data(), static_cast<uint32_t>(bvh4.nodes.size()), sizeof(WideBVHNode<4>));
+#if WIDE_BVH8_SUPPORTED
+		if (layout == BVHLayout::Wide8)
+			return SaveBVH(path, sceneHash, bvh, 8, bvh8.nodes.data(), static_cast<uint32_t>(bvh8.nodes.size()), sizeof(WideBVHNode<8>));
+#endif
+		return SaveBVH(path, sceneHash, bvh, 0, nullptr, 0, 0);
+	}
+
+	// Maps a file written by Save and traverses it in place. Fails if the file is missing, from another version, or was
+	// built for different geometries. Wide nodes are collapsed after loading if the file does not contain the requested layout.
+	bool Load(const char* path, const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings)
+	{
+		unique_ptr<MappedFile> file = make_unique<MappedFile>();
+		if (!file->Open(path))
+			return false;
+
+		const BVHFileHeader* header = ValidateBVHFile(*file, ComputeSceneHash(geometries), geometries.size());
+		if (!header)
+			return false;
+
+		const uint8_t* data = (const uint8_t*)file->data;
+
+		const uint32_t* primitiveIndices = (const uint32_t*)(data + header->primitiveIndicesOffset);
+		for (uint32_t i = 0; i < header->primitiveCount; i++)
+		{
+			if (primitiveIndices[i] >= geometries.size())
+				return false;
+		}
+
+		Clear();
+
+		buildSettings = settings;
+
+		bvh.nodes.Attach((const LinearBVHNode*)(data + header->nodesOffset), header->nodeCount);
+		bvh.primitiveIndices.Attach(primitiveIndices, header->primitiveCount);
+		bvh.ResolvePrimitives(geometries);
+		bvh.builtSAHCost = header->builtSAHCost;
+
+		SetLayout(settings.layout);
+
+		if (layout == BVHLayout::Wide4)
+		{
+			if (header->wideWidth == 4)
+				bvh4.Attach(bvh, (const WideBVHNode<4>*)(data + header->wideNodesOffset), header->wideNodeCount);
+			else
+				bvh4.Build(bvh);
+		}
+#if WIDE_BVH8_SUPPORTED
+		else if (layout == BVHLayout::Wide8)
+		{
+			if (header->wideWidth == 8)
+				bvh8.Attach(bvh, (const WideBVHNode<8>*)(data + header->wideNodesOffset), header->wideNodeCount);
+			else
+				bvh8.Build(bvh);
+		}
+#endif
+		else
+		{
+			BuildDerivedLayout();
+		}
+
+		mappedFile = std::move(file);
+
+		return true;
+	}
+
+	// See Scene::ComputeAccelerationStructureStats.
+	BVHStats ComputeStats(const std::vector<RayDesc>* rays)
+	{
+		const bool released = binaryNodesReleased;
+		UnpackBinaryNodes();
+
+		BVHStats stats = ComputeBVHStats(bvh, buildSettings.traversalCost, buildSettings.intersectionCost);
+		stats.layoutMemorySize = GetLayoutMemorySize();
+
+		if (rays)
+			EstimateBVHTraversal(bvh, *rays, stats);
+
+		if (released)
+			ReleaseBinaryNodes();
+
+		return stats;
+	}
+
+private:
+	// Wide, quantized and stackless layouts are built from the binary BVH, which is kept for refitting and rebuilding
+	// them, except by the quantized layout.
+	void BuildDerivedLayout()
+	{
+		binaryNodesReleased = false;
+
+		if (layout == BVHLayout::Wide4)
+			bvh4.Build(bvh);
+#if WIDE_BVH8_SUPPORTED
+		else if (layout == BVHLayout::Wide8)
+			bvh8.Build(bvh);
+#endif
+		else if (layout == BVHLayout::Quantized)
+			BuildQuantizedLayout();
+		else if (layout == BVHLayout::Stackless)
+			stacklessBVH.Build(bvh);
+	}
+
+	// Trees with more primitive references than quantized leaves can address, which SBVH builds can reach, fall back to Wide4.
+	void BuildQuantizedLayout()
+	{
+		if (quantizedBVH.Build(bvh))
+		{
+			ReleaseBinaryNodes();
+		}
+		else
+		{
+			layout = BVHLayout::Wide4;
+			bvh4.Build(bvh);
+		}
+	}
+
+	// The quantized BVH is a third of the size of the binary nodes, keeping both would use more memory than the binary BVH alone.
+	void ReleaseBinaryNodes()
+	{
+		bvh.nodes.clear();
+		binaryNodesReleased = true;
+	}
+
+	void UnpackBinaryNodes()
+	{
+		if (!binaryNodesReleased)
+			return;
+
+		quantizedBVH.Unpack(bvh.nodes);
+		binaryNodesReleased = false;
+	}
+
+	void SetLayout(BVHLayout requestedLayout)
+	{
+		layout = requestedLayout;
+#if !WIDE_BVH8_SUPPORTED
+		if (layout == BVHLayout::Wide8)
+			layout = BVHLayout::Wide4;
+#endif
+	}
+
+	size_t GetLayoutMemorySize() const
+	{
+		if (lazy)
+			return lazyBVH.GetMemorySize();
+		if (layout == BVHLayout::Wide4)
+			return bvh4.GetMemorySize();
+#if WIDE_BVH8_SUPPORTED
+		if (layout == BVHLayout::Wide8)
+			return bvh8.GetMemorySize();
+#endif
+		if (layout == BVHLayout::Quantized)
+			return quantizedBVH.GetMemorySize();
+		if (layout == BVHLayout::Stackless)
+			return stacklessBVH.GetMemorySize();
+		return 0;
+	}
+
+public:
+	BVHBuildSettings			buildSettings;
+	LinearBVH					bvh;
+	WideBVH<4>					bvh4;
+#if WIDE_BVH8_SUPPORTED
+	WideBVH<8>					bvh8;
+#endif
+	QuantizedBVH				quantizedBVH;
+	StacklessBVH				stacklessBVH;
+	LazyBVH						lazyBVH;
+	bool						lazy = false;	// Rays traverse lazyBVH instead of the layouts above.
+	bool						binaryNodesReleased = false;	// bvh.nodes are only in quantizedBVH, see UnpackBinaryNodes.
+	BVHLayout					layout = BVHLayout::Wide4;
+	unique_ptr<MappedFile>		mappedFile;	// Backs the BVH arrays after Load.
+};
+
+#endif // BVH_ACCELERATION_STRUCTURE_H
@@ -0,0 +1,86 @@
+#ifndef BVH_ARRAY_H
+#define BVH_ARRAY_H
+
+#include <vector>
+
+// Contiguous array of BVH data that either owns its elements or refers to read-only memory owned elsewhere,
+// such as a memory-mapped acceleration structure file. Modifying an external array copies it first.
+template <typename T>
+class BVHArray
+{
+public:
+	// Refers to count elements at data without copying them. The memory must outlive the array or the next Attach / Clear.
+	void Attach(const T* data, size_t count)
+	{
+		owned = std::vector<T>();
+		external = data;
+		externalCount = count;
+	}
+
+	bool IsExternal() const { return external != nullptr; }
+
+	size_t size() const { return external ? externalCount : owned.size(); }
+	bool empty() const { return size() == 0; }
+
+	const T* data() const { return external ? external : owned.data(); }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + size(); }
+
+	const T& operator[](size_t i) const { return data()[i]; }
+
+	T& operator[](size_t i)
+	{
+		MakeOwned();
+		return owned[i];
+	}
+
+	// Also releases the owned memory.
+	void clear()
+	{
+		external = nullptr;
+		externalCount = 0;
+		owned = std::vector<T>();
+	}
+
+	void resize(size_t count)
+	{
+		MakeOwned();
+		owned.resize(count);
+	}
+
+	void reserve(size_t count)
+	{
+		MakeOwned();
+		owned.reserve(count);
+	}
+
+	void emplace_back()
+	{
+		MakeOwned();
+		owned.emplace_back();
+	}
+
+	BVHArray& operator=(const std::vector<T>& elements)
+	{
+		clear();
+		owned = elements;
+		return *this;
+	}
+
+private:
+	void MakeOwned()
+	{
+		if (external)
+		{
+			owned.assign(external, external + externalCount);
+			external = nullptr;
+			externalCount = 0;
+		}
+	}
+
+	std::vector<T>	owned;
+	const T*		external = nullptr;
+	size_t			externalCount = 0;
+};
+
+#endif // BVH_ARRAY_H
@@ -0,0 +1,94 @@
+#ifndef BVH_LANES_H
+#define BVH_LANES_H
+
+#include <cstdint>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Leaf primitives are tested 8 at a time with AVX2 (/arch:AVX2 or -mavx2), 4 at a time with SSE otherwise.
+#if defined(__AVX2__)
+const uint32_t s_BVHLaneCount = 8;
+#else
+const uint32_t s_BVHLaneCount = 4;
+#endif
+
+// Float lanes of the leaf primitive kernels, one primitive per lane, so that a kernel is written once for both widths.
+// Comparisons return all bits set in the lanes where they hold.
+class BVHLanes
+{
+protected:
+#if defined(__AVX2__)
+	typedef __m256 Lanes;
+
+	static inline Lanes Broadcast(float value) { return _mm256_set1_ps(value); }
+	static inline Lanes Load(const float* values) { return _mm256_loadu_ps(values); }
+	static inline void Store(float* values, Lanes a) { _mm256_storeu_ps(values, a); }
+	static inline Lanes Add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+	static inline Lanes Sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+	static inline Lanes Mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+	static inline Lanes Div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+	static inline Lanes Sqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+	static inline Lanes And(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+	static inline Lanes Or(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+	static inline Lanes Xor(Lanes a, Lanes b) { return _mm256_xor_ps(a, b); }
+	static inline Lanes Less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static inline Lanes Greater(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	static inline Lanes LessEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static inline Lanes Equal(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	static inline Lanes NotEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+	static inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+	static inline int MoveMask(Lanes a) { return _mm256_movemask_ps(a); }
+#else
+	typedef __m128 Lanes;
+
+	static inline Lanes Broadcast(float value) { return _mm_set1_ps(value); }
+	static inline Lanes Load(const float* values) { return _mm_loadu_ps(values); }
+	static inline void Store(float* values, Lanes a) { _mm_storeu_ps(values, a); }
+	static inline Lanes Add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+	static inline Lanes Sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+	static inline Lanes Mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+	static inline Lanes Div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+	static inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a); }
+	static inline Lanes And(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+	static inline Lanes Or(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+	static inline Lanes Xor(Lanes a, Lanes b) { return _mm_xor_ps(a, b); }
+	static inline Lanes Less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+	static inline Lanes Greater(Lanes a, Lanes b) { return _mm_cmpgt_ps(a, b); }
+	static inline Lanes GreaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+	static inline Lanes LessEqual(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+	static inline Lanes Equal(Lanes a, Lanes b) { return _mm_cmpeq_ps(a, b); }
+	static inline Lanes NotEqual(Lanes a, Lanes b) { return _mm_cmpneq_ps(a, b); }
+	static inline Lanes Select(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	static inline int MoveMask(Lanes a) { return _mm_movemask_ps(a); }
+#endif
+
+	// Sign bit of every lane, to flip or clear signs with Xor and And.
+	static inline Lanes SignMask() { return Broadcast(-0.0f); }
+
+	// Rounds a product on its own, so that GCC and Clang do not fuse it into an FMA with the operation that uses it,
+	// even with -mfma and -ffp-contract=fast. MSVC kernels that need it turn contraction off with fp_contract instead.
+	static inline Lanes Unfused(Lanes a)
+	{
+#if defined(__GNUC__)
+		__asm__("" : "+x"(a));
+#endif
+		return a;
+	}
+
+	static inline uint32_t BitScanForward(uint32_t mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+};
+
+#endif // BVH_LANES_H
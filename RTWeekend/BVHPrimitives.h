@@ -0,0 +1,149 @@
+#ifndef BVH_PRIMITIVES_H
+#define BVH_PRIMITIVES_H
+
+#include <vector>
+
+#include "BVHSphereList.h"
+#include "Geometry.h"
+#include "Sphere.h"
+
+// Closest hit of a traversal while it is searched. A sphere hit only records the sphere, with the distance in the tmax
+// of the traversal ray, and Resolve computes its hit attributes once the traversal is done, so spheres that a closer
+// hit replaces never compute a normal or UVs. Other primitives fill the HitDesc when hit and clear the sphere.
+struct PrimitiveHit
+{
+	inline void Resolve(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (sphere)
+			sphere->SetHitAttributes(rayDesc, rayDesc.tmax, hitDesc);
+	}
+
+	const Sphere*	sphere = nullptr;
+};
+
+// Leaf primitives of an acceleration structure in storage order, each leaf referencing a contiguous range.
+// The type of each primitive is stored next to it, and primitive types with a list of their own, spheres so far, are
+// also copied into it. A range is tested as runs of primitives of the same type, each run with the loop of its type, so
+// only primitives without a list go through the Geometry virtual functions.
+// The builders store the primitives of a leaf grouped by type, see GeometryType, so a leaf is usually a single run.
+class BVHPrimitives
+{
+public:
+	void Build(const std::vector<shared_ptr<Geometry>>& sceneGeometries, const uint32_t* indices, size_t count)
+	{
+		Resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			Set(i, sceneGeometries[indices[i]].get());
+		}
+	}
+
+	void Clear()
+	{
+		geometries.clear();
+		types.clear();
+		spheres.Clear();
+	}
+
+	// Copies the typed lists again after geometries moved.
+	void Refit()
+	{
+		for (size_t i = 0; i < geometries.size(); i++)
+		{
+			Set(i, geometries[i]);
+		}
+	}
+
+	// Grows or shrinks the store. New entries hold no primitive until Set.
+	void Resize(size_t count)
+	{
+		geometries.resize(count, nullptr);
+		types.resize(count, GeometryType::Other);
+		spheres.Resize(count);
+	}
+
+	void Set(size_t i, const Geometry* geometry)
+	{
+		geometries[i] = geometry;
+		types[i] = geometry ? geometry->GetType() : GeometryType::Other;
+
+		if (types[i] == GeometryType::Sphere)
+			spheres.Set(i, *static_cast<const Sphere*>(geometry));
+		else
+			spheres.Reset(i);
+	}
+
+	size_t size() const { return geometries.size(); }
+
+	size_t GetMemorySize() const
+	{
+		return geometries.size() * (sizeof(const Geometry*) + sizeof(GeometryType)) + spheres.GetMemorySize();
+	}
+
+	// Tests the primitives [first, first + count) and shortens rayDesc.tmax to the closest hit. The hit attributes of a
+	// closest sphere are left to closestHit.Resolve.
+	bool Hit(uint32_t first, uint32_t count, RayDesc& rayDesc, HitDesc& hitDesc, PrimitiveHit& closestHit) const
+	{
+		bool hitFound = false;
+
+		const uint32_t end = first + count;
+		for (uint32_t runStart = first; runStart < end;)
+		{
+			const GeometryType type = types[runStart];
+
+			uint32_t runEnd = runStart + 1;
+			while (runEnd < end && types[runEnd] == type)
+				runEnd++;
+
+			switch (type)
+			{
+			case GeometryType::Sphere:
+			{
+				uint32_t hitIndex;
+				if (spheres.Hit(runStart, runEnd - runStart, rayDesc, hitIndex))
+				{
+					hitFound = true;
+					closestHit.sphere = static_cast<const Sphere*>(geometries[hitIndex]);
+				}
+				break;
+			}
+			default:
+				if (HitGeometries(runStart, runEnd - runStart, rayDesc, hitDesc, closestHit))
+					hitFound = true;
+				break;
+			}
+
+			runStart = runEnd;
+		}
+
+		return hitFound;
+	}
+
+	const Geometry* operator[](size_t i) const { return geometries[i]; }
+
+private:
+	// Primitives without a list of their own.
+	inline bool HitGeometries(uint32_t first, uint32_t count, RayDesc& rayDesc, HitDesc& hitDesc, PrimitiveHit& closestHit) const
+	{
+		bool hitFound = false;
+
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			if (geometries[i]->Hit(rayDesc, hitDesc))
+			{
+				hitFound = true;
+				closestHit.sphere = nullptr;
+				rayDesc.tmax = hitDesc.t;
+			}
+		}
+
+		return hitFound;
+	}
+
+public:
+	std::vector<const Geometry*>	geometries;
+	std::vector<GeometryType>		types;
+	BVHSphereList					spheres;	// Entries of all primitives, only those of spheres hold one.
+};
+
+#endif // BVH_PRIMITIVES_H
@@ -0,0 +1,171 @@
+#ifndef BVH_REORDER_H
+#define BVH_REORDER_H
+
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "BVH.h"
+
+// Computes a memory order for the nodes of a BVH after it is built. The tree is given as units, the blocks of nodes
+// that have to stay together (a sibling pair in the binary BVH): unit 0 is the root and the children of unit u are
+// childUnits[childStart[u]] to childUnits[childStart[u + 1] - 1]. Every order stores parents before their children.
+class BVHReorder
+{
+public:
+	BVHReorder(const std::vector<uint32_t>& childStart, const std::vector<uint32_t>& childUnits) :
+		childStart(childStart),
+		childUnits(childUnits)
+	{
+	}
+
+	// Returns the units in storage order. visitCounts, one per unit, is only used by BVHNodeOrder::VisitCount and
+	// may be null, in which case the whole tree is considered cold.
+	std::vector<uint32_t> Compute(BVHNodeOrder nodeOrder, const std::vector<uint64_t>* visitCounts, float hotVisitFraction)
+	{
+		const uint32_t unitCount = static_cast<uint32_t>(childStart.size() - 1);
+
+		order.clear();
+		order.reserve(unitCount);
+
+		ComputeHeights();
+
+		if (nodeOrder == BVHNodeOrder::VanEmdeBoas)
+		{
+			LayoutVanEmdeBoas(0, heights[0]);
+		}
+		else if (nodeOrder == BVHNodeOrder::VisitCount)
+		{
+			LayoutByVisitCount(visitCounts, hotVisitFraction);
+		}
+		else
+		{
+			LayoutDepthFirst(0);
+		}
+
+		return order;
+	}
+
+private:
+	// Height of every unit's subtree in units, 1 for units without children. Children are numbered after their
+	// parent in all trees handed to this class, so a reverse sweep sees children first.
+	void ComputeHeights()
+	{
+		const uint32_t unitCount = static_cast<uint32_t>(childStart.size() - 1);
+
+		heights.assign(unitCount, 1);
+		for (uint32_t unit = unitCount; unit-- > 0;)
+		{
+			for (uint32_t i = childStart[unit]; i < childStart[unit + 1]; i++)
+			{
+				heights[unit] = std::max<uint32_t>(heights[unit], heights[childUnits[i]] + 1);
+			}
+		}
+	}
+
+	void LayoutDepthFirst(uint32_t unit)
+	{
+		order.push_back(unit);
+
+		for (uint32_t i = childStart[unit]; i < childStart[unit + 1]; i++)
+		{
+			LayoutDepthFirst(childUnits[i]);
+		}
+	}
+
+	// van Emde Boas layout of the units of the subtree of unit that are less than levels levels deep: the top half of the
+	// levels is laid out first, then every subtree hanging below it. Any block of memory then holds a subtree of about
+	// the same number of levels, whatever the cache line or page size, so a root to leaf path touches few blocks.
+	void LayoutVanEmdeBoas(uint32_t unit, uint32_t levels)
+	{
+		if (levels == 1)
+		{
+			order.push_back(unit);
+			return;
+		}
+
+		const uint32_t topLevels = levels / 2;
+
+		LayoutVanEmdeBoas(unit, topLevels);
+
+		std::vector<uint32_t> bottomUnits;
+		CollectUnitsAtDepth(unit, topLevels, bottomUnits);
+
+		for (uint32_t bottomUnit : bottomUnits)
+		{
+			LayoutVanEmdeBoas(bottomUnit, std::min<uint32_t>(levels - topLevels, heights[bottomUnit]));
+		}
+	}
+
+	void CollectUnitsAtDepth(uint32_t unit, uint32_t depth, std::vector<uint32_t>& units)
+	{
+		if (depth == 0)
+		{
+			units.push_back(unit);
+			return;
+		}
+
+		for (uint32_t i = childStart[unit]; i < childStart[unit + 1]; i++)
+		{
+			CollectUnitsAtDepth(childUnits[i], depth - 1, units);
+		}
+	}
+
+	// Hot units, visited by at least hotVisitFraction of the rays that visit the root, are packed first from the most
+	// visited one down. A unit is never visited more often than its parent, so they form a connected top of the tree.
+	// Every cold subtree hanging below them is then stored contiguously in van Emde Boas order.
+	void LayoutByVisitCount(const std::vector<uint64_t>* visitCounts, float hotVisitFraction)
+	{
+		const uint64_t hotThreshold = visitCounts ? std::max<uint64_t>(static_cast<uint64_t>((*visitCounts)[0] * hotVisitFraction), 1) : 0;
+
+		auto isHot = [&](uint32_t unit)
+		{
+			return visitCounts && (*visitCounts)[unit] >= hotThreshold;
+		};
+
+		auto hotter = [&](uint32_t a, uint32_t b)
+		{
+			return (*visitCounts)[a] < (*visitCounts)[b];
+		};
+
+		std::vector<uint32_t> coldUnits;
+
+		if (isHot(0))
+		{
+			std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(hotter)> queue(hotter);
+			queue.push(0);
+
+			while (!queue.empty())
+			{
+				const uint32_t unit = queue.top();
+				queue.pop();
+
+				order.push_back(unit);
+
+				for (uint32_t i = childStart[unit]; i < childStart[unit + 1]; i++)
+				{
+					if (isHot(childUnits[i]))
+						queue.push(childUnits[i]);
+					else
+						coldUnits.push_back(childUnits[i]);
+				}
+			}
+		}
+		else
+		{
+			coldUnits.push_back(0);
+		}
+
+		for (uint32_t unit : coldUnits)
+		{
+			LayoutVanEmdeBoas(unit, heights[unit]);
+		}
+	}
+
+	const std::vector<uint32_t>&	childStart;
+	const std::vector<uint32_t>&	childUnits;
+	std::vector<uint32_t>			heights;
+	std::vector<uint32_t>			order;
+};
+
+#endif // BVH_REORDER_H
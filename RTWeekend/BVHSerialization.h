@@ -0,0 +1,225 @@
+#ifndef BVH_SERIALIZATION_H
+#define BVH_SERIALIZATION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "LinearBVH.h"
+#include "MappedFile.h"
+#include "WideBVH.h"
+
+// Prebuilt acceleration structure file. The arrays are stored exactly as they are laid out in memory, at 64 byte
+// aligned offsets, so a memory-mapped file is traversed in place without parsing or copying.
+// Bump the version whenever the header or any node layout changes.
+const uint32_t s_BVHFileMagic = 0x48564252;	// "RBVH"
+const uint32_t s_BVHFileVersion = 1;
+const uint64_t s_BVHFileAlignment = 64;
+
+struct BVHFileHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	sceneHash;				// ComputeSceneHash of the geometries the BVH was built for.
+	uint32_t	nodeSize;				// sizeof(LinearBVHNode)
+	uint32_t	nodeCount;
+	uint32_t	primitiveCount;
+	uint32_t	wideWidth;				// 4 or 8 if the wide nodes of the scene layout are stored too, 0 otherwise.
+	uint32_t	wideNodeCount;
+	float		builtSAHCost;
+	uint64_t	nodesOffset;
+	uint64_t	primitiveIndicesOffset;
+	uint64_t	wideNodesOffset;
+};
+
+// FNV-1a hash of the geometry count and bounds, the inputs the BVH depends on.
+inline uint64_t ComputeSceneHash(const std::vector<shared_ptr<Geometry>>& geometries)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	auto hashBytes = [&hash](const void* data, size_t size)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+		}
+	};
+
+	uint64_t count = geometries.size();
+	hashBytes(&count, sizeof(count));
+
+	for (const auto& geometry : geometries)
+	{
+		AABB aabb;
+		geometry->GetBoundingBox(aabb);
+		hashBytes(&aabb, sizeof(aabb));
+	}
+
+	return hash;
+}
+
+inline uint64_t AlignBVHFileOffset(uint64_t offset)
+{
+	return (offset + s_BVHFileAlignment - 1) & ~(s_BVHFileAlignment - 1);
+}
+
+// Writes the binary BVH and optionally the wide nodes collapsed from it.
+inline bool SaveBVH(const char* path, uint64_t sceneHash, const LinearBVH& bvh, uint32_t wideWidth, const void* wideNodes, uint32_t wideNodeCount, size_t wideNodeSize)
+{
+	BVHFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = s_BVHFileMagic;
+	header.version = s_BVHFileVersion;
+	header.sceneHash = sceneHash;
+	header.nodeSize = sizeof(LinearBVHNode);
+	header.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+	header.primitiveCount = static_cast<uint32_t>(bvh.primitiveIndices.size());
+	header.wideWidth = wideNodes ? wideWidth : 0;
+	header.wideNodeCount = wideNodes ? wideNodeCount : 0;
+	header.builtSAHCost = bvh.builtSAHCost;
+	header.nodesOffset = AlignBVHFileOffset(sizeof(BVHFileHeader));
+	header.primitiveIndicesOffset = AlignBVHFileOffset(header.nodesOffset + header.nodeCount * sizeof(LinearBVHNode));
+	header.wideNodesOffset = AlignBVHFileOffset(header.primitiveIndicesOffset + header.primitiveCount * sizeof(uint32_t));
+
+	FILE* f = nullptr;
+#if defined(_WIN32)
+	fopen_s(&f, path, "wb");
+#else
+	f = fopen(path, "wb");
+#endif
+
+	if (!f)
+		return false;
+
+	const uint8_t padding[s_BVHFileAlignment] = {};
+	uint64_t position = 0;
+
+	auto write = [&](uint64_t offset, const void* data, size_t size)
+	{
+		bool ok = fwrite(padding, 1, static_cast<size_t>(offset - position), f) == offset - position;
+		ok = ok && (size == 0 || fwrite(data, 1, size, f) == size);
+		position = offset + size;
+		return ok;
+	};
+
+	bool ok = write(0, &header, sizeof(header));
+	ok = ok && write(header.nodesOffset, bvh.nodes.data(), header.nodeCount * sizeof(LinearBVHNode));
+	ok = ok && write(header.primitiveIndicesOffset, bvh.primitiveIndices.data(), header.primitiveCount * sizeof(uint32_t));
+	ok = ok && write(header.wideNodesOffset, wideNodes, header.wideNodeCount * wideNodeSize);
+
+	fclose(f);
+
+	return ok;
+}
+
+// Checks that count elements of size bytes at offset are inside the file, without overflowing.
+inline bool IsBVHFileRangeValid(const MappedFile& file, uint64_t offset, uint64_t count, uint64_t size)
+{
+	return offset % s_BVHFileAlignment == 0 && offset <= file.size && (size == 0 || count <= (file.size - offset) / size);
+}
+
+// Traversal trusts the node contents, so every child and primitive range is checked. Children are stored after their
+// parent, which also rules out cycles, and the tree must fit in the traversal stack.
+inline bool ValidateBVHNodes(const LinearBVHNode* nodes, uint32_t nodeCount, uint32_t primitiveCount)
+{
+	std::vector<uint32_t> depths(nodeCount, 0);
+
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		const LinearBVHNode& node = nodes[i];
+
+		if (node.IsLeaf())
+		{
+			if (node.offset > primitiveCount || node.primitiveCount > primitiveCount - node.offset)
+				return false;
+		}
+		else if (node.offset <= i || node.offset >= nodeCount - 1 || depths[i] >= s_BVHStackSize)
+		{
+			return false;
+		}
+		else
+		{
+			depths[node.offset] = depths[i] + 1;
+			depths[node.offset + 1] = depths[i] + 1;
+		}
+	}
+
+	return true;
+}
+
+// Same as above for wide nodes. Empty slots keep the inverted infinite bounds they are initialized with, so that no
+// ray enters them.
+template <int Width>
+inline bool ValidateBVHNodes(const WideBVHNode<Width>* nodes, uint32_t nodeCount, uint32_t primitiveCount)
+{
+	std::vector<uint32_t> depths(nodeCount, 0);
+
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		const WideBVHNode<Width>& node = nodes[i];
+
+		for (int slot = 0; slot < Width; slot++)
+		{
+			if (node.IsLeaf(slot))
+			{
+				if (node.offset[slot] > primitiveCount || node.primitiveCount[slot] > primitiveCount - node.offset[slot])
+					return false;
+			}
+			else if (node.minX[slot] == infinity && node.maxX[slot] == -infinity)
+			{
+				continue;
+			}
+			else if (node.offset[slot] <= i || node.offset[slot] >= nodeCount || depths[i] >= s_BVHStackSize)
+			{
+				return false;
+			}
+			else
+			{
+				depths[node.offset[slot]] = depths[i] + 1;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Checks that a mapped file is a complete BVH file of this version for the given scene, with valid nodes.
+inline const BVHFileHeader* ValidateBVHFile(const MappedFile& file, uint64_t sceneHash, size_t geometryCount)
+{
+	if (!file.data || file.size < sizeof(BVHFileHeader))
+		return nullptr;
+
+	const BVHFileHeader* header = (const BVHFileHeader*)file.data;
+
+	if (header->magic != s_BVHFileMagic ||
+		header->version != s_BVHFileVersion ||
+		header->nodeSize != sizeof(LinearBVHNode) ||
+		header->sceneHash != sceneHash ||
+		header->primitiveCount < geometryCount ||	// Spatial splits can reference a primitive more than once.
+		header->nodeCount == 0 ||
+		(header->wideWidth != 0 && header->wideWidth != 4 && header->wideWidth != 8))
+		return nullptr;
+
+	size_t wideNodeSize = (header->wideWidth == 4) ? sizeof(WideBVHNode<4>) : (header->wideWidth == 8) ? sizeof(WideBVHNode<8>) : 0;
+
+	if (!IsBVHFileRangeValid(file, header->nodesOffset, header->nodeCount, sizeof(LinearBVHNode)) ||
+		!IsBVHFileRangeValid(file, header->primitiveIndicesOffset, header->primitiveCount, sizeof(uint32_t)) ||
+		!IsBVHFileRangeValid(file, header->wideNodesOffset, header->wideNodeCount, wideNodeSize))
+		return nullptr;
+
+	const uint8_t* data = (const uint8_t*)file.data;
+
+	if (!ValidateBVHNodes((const LinearBVHNode*)(data + header->nodesOffset), header->nodeCount, header->primitiveCount))
+		return nullptr;
+
+	if (header->wideWidth == 4 && !ValidateBVHNodes((const WideBVHNode<4>*)(data + header->wideNodesOffset), header->wideNodeCount, header->primitiveCount))
+		return nullptr;
+
+	if (header->wideWidth == 8 && !ValidateBVHNodes((const WideBVHNode<8>*)(data + header->wideNodesOffset), header->wideNodeCount, header->primitiveCount))
+		return nullptr;
+
+	return header;
+}
+
+#endif // BVH_SERIALIZATION_H
@@ -0,0 +1,178 @@
+#ifndef BVH_SPHERE_LIST_H
+#define BVH_SPHERE_LIST_H
+
+#include <algorithm>
+#include <vector>
+
+#include "BVHLanes.h"
+#include "Sphere.h"
+
+// Sphere centers and squared radii of BVHPrimitives as structure of arrays, at the index of the primitive, so a run of
+// spheres is tested s_BVHLaneCount at a time without following a pointer or a virtual call. Entries of other
+// primitives have a squared radius of -infinity, which no ray hits.
+class BVHSphereList : private BVHLanes
+{
+public:
+	void Clear()
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			centers[axis].clear();
+		}
+		radii2.clear();
+	}
+
+	// The arrays are padded so that the kernel can load full registers at the end of the last run.
+	void Resize(size_t count)
+	{
+		const size_t paddedCount = count + s_BVHLaneCount - 1;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			centers[axis].resize(paddedCount, 0.0f);
+		}
+		radii2.resize(paddedCount, -infinity);
+
+		for (size_t i = count; i < paddedCount; i++)
+		{
+			radii2[i] = -infinity;
+		}
+	}
+
+	void Set(size_t i, const Sphere& sphere)
+	{
+		centers[0][i] = sphere.center.x;
+		centers[1][i] = sphere.center.y;
+		centers[2][i] = sphere.center.z;
+		radii2[i] = sphere.radius2;
+	}
+
+	void Reset(size_t i)
+	{
+		centers[0][i] = 0.0f;
+		centers[1][i] = 0.0f;
+		centers[2][i] = 0.0f;
+		radii2[i] = -infinity;
+	}
+
+	size_t GetMemorySize() const
+	{
+		return radii2.size() * 4 * sizeof(float);
+	}
+
+	// Sphere::Intersect for the spheres [first, first + count). Returns the index of the closest hit in
+	// [rayDesc.tmin, rayDesc.tmax] and shortens rayDesc.tmax to it.
+	bool Hit(uint32_t first, uint32_t count, RayDesc& rayDesc, uint32_t& hitIndex) const
+	{
+		// A single sphere does not fill a register.
+		if (count == 1)
+		{
+			const Vector3f center(centers[0][first], centers[1][first], centers[2][first]);
+
+			float t;
+			if (!Sphere::Intersect(center, radii2[first], rayDesc, t))
+				return false;
+
+			hitIndex = first;
+			rayDesc.tmax = t;
+			return true;
+		}
+
+		bool hitFound = false;
+
+		const SphereRay ray(rayDesc);
+
+		for (uint32_t i = first; i < first + count; i += s_BVHLaneCount)
+		{
+			const uint32_t laneCount = std::min<uint32_t>(first + count - i, s_BVHLaneCount);
+			const uint32_t laneMask = (1u << laneCount) - 1;
+
+			uint32_t hitLane;
+			if (HitLanes(ray, i, laneMask, rayDesc.tmin, rayDesc.tmax, hitLane))
+			{
+				hitFound = true;
+				hitIndex = i + hitLane;
+			}
+		}
+
+		return hitFound;
+	}
+
+private:
+	// Ray broadcast to all lanes once per Hit call.
+	struct SphereRay
+	{
+		SphereRay(const RayDesc& rayDesc) :
+			originX(Broadcast(rayDesc.ray.origin.x)),
+			originY(Broadcast(rayDesc.ray.origin.y)),
+			originZ(Broadcast(rayDesc.ray.origin.z)),
+			directionX(Broadcast(rayDesc.ray.direction.x)),
+			directionY(Broadcast(rayDesc.ray.direction.y)),
+			directionZ(Broadcast(rayDesc.ray.direction.z)),
+			a(Broadcast(rayDesc.ray.direction.LengthSquared())),
+			invA(Broadcast(1.0f / rayDesc.ray.direction.LengthSquared()))
+		{
+		}
+
+		Lanes originX, originY, originZ;
+		Lanes directionX, directionY, directionZ;
+		Lanes a, invA;
+	};
+
+	// Sphere::Intersect for the lanes of laneMask, starting at sphere first. Returns the lane of the closest hit in
+	// [tmin, tmax] and shortens tmax to it.
+	inline bool HitLanes(const SphereRay& ray, uint32_t first, uint32_t laneMask, float tmin, float& tmax, uint32_t& hitLane) const
+	{
+		const Lanes ocX = Sub(ray.originX, Load(&centers[0][first]));
+		const Lanes ocY = Sub(ray.originY, Load(&centers[1][first]));
+		const Lanes ocZ = Sub(ray.originZ, Load(&centers[2][first]));
+
+		const Lanes halfb = Add(Add(Mul(ocX, ray.directionX), Mul(ocY, ray.directionY)), Mul(ocZ, ray.directionZ));
+		const Lanes c = Sub(Add(Add(Mul(ocX, ocX), Mul(ocY, ocY)), Mul(ocZ, ocZ)), Load(&radii2[first]));
+		const Lanes delta = Sub(Mul(halfb, halfb), Mul(ray.a, c));
+
+		// Primitives of other types and the padding have no real roots, their delta is negative or NaN.
+		const Lanes zero = Broadcast(0.0f);
+		const Lanes hasRoots = GreaterEqual(delta, zero);
+		if ((static_cast<uint32_t>(MoveMask(hasRoots)) & laneMask) == 0)
+			return false;
+
+		const Lanes sqrtDelta = Sqrt(And(delta, hasRoots));
+		const Lanes tminLanes = Broadcast(tmin);
+		const Lanes tmaxLanes = Broadcast(tmax);
+
+		// The near root, or the far one if the near one is outside [tmin, tmax].
+		const Lanes minusHalfb = Sub(zero, halfb);
+		const Lanes nearRoot = Mul(Sub(minusHalfb, sqrtDelta), ray.invA);
+		const Lanes farRoot = Mul(Add(minusHalfb, sqrtDelta), ray.invA);
+		const Lanes nearInRange = And(GreaterEqual(nearRoot, tminLanes), LessEqual(nearRoot, tmaxLanes));
+		const Lanes root = Select(nearInRange, nearRoot, farRoot);
+		const Lanes inRange = And(hasRoots, And(GreaterEqual(root, tminLanes), LessEqual(root, tmaxLanes)));
+
+		uint32_t mask = static_cast<uint32_t>(MoveMask(inRange)) & laneMask;
+		if (mask == 0)
+			return false;
+
+		// Few lanes hit at once, a scalar scan of them is cheaper than a horizontal min.
+		float roots[s_BVHLaneCount];
+		Store(roots, root);
+
+		hitLane = BitScanForward(mask);
+		mask &= mask - 1;
+		while (mask != 0)
+		{
+			const uint32_t lane = BitScanForward(mask);
+			mask &= mask - 1;
+
+			if (roots[lane] < roots[hitLane])
+				hitLane = lane;
+		}
+
+		tmax = roots[hitLane];
+		return true;
+	}
+
+	std::vector<float>	centers[3];	// Per axis.
+	std::vector<float>	radii2;		// -infinity for primitives of other types and for the padding.
+};
+
+#endif // BVH_SPHERE_LIST_H
@@ -0,0 +1,169 @@
+#ifndef BVH_STATS_H
+#define BVH_STATS_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "LinearBVH.h"
+
+// Quality and size figures of a built BVH, to compare build modes, settings and scene layouts without rendering.
+struct BVHStats
+{
+	float					sahCost = 0.0f;				// LinearBVH::ComputeSAHCost with the build costs.
+
+	uint32_t				nodeCount = 0;
+	uint32_t				interiorNodeCount = 0;
+	uint32_t				leafCount = 0;
+	uint32_t				primitiveReferenceCount = 0;	// More than the geometry count when SBVH splits primitives.
+	uint32_t				maxLeafSize = 0;
+
+	std::vector<uint32_t>	leafDepthHistogram;			// Number of leaves at every depth, the root being at depth 0.
+	float					averageLeafDepth = 0.0f;
+
+	// Surface area of the intersection of the two children of an interior node relative to the node surface area,
+	// averaged over all interior nodes. Rays entering the overlap have to visit both children.
+	float					averageSiblingOverlap = 0.0f;
+
+	size_t					binaryMemorySize = 0;		// Binary nodes and primitive indices.
+	size_t					layoutMemorySize = 0;		// Nodes of the wide or quantized layout traversed instead, if any.
+
+	double					buildTime = 0.0;			// Seconds, including reordering and building the traversed layout.
+
+	// Filled by EstimateBVHTraversal, 0 otherwise.
+	uint32_t				estimateRayCount = 0;
+	float					nodesVisitedPerRay = 0.0f;
+	float					primitivesTestedPerRay = 0.0f;
+};
+
+inline BVHStats ComputeBVHStats(const LinearBVH& bvh, float traversalCost, float intersectionCost)
+{
+	BVHStats stats;
+
+	if (bvh.nodes.empty())
+		return stats;
+
+	const LinearBVHNode* nodeData = bvh.nodes.data();
+
+	stats.sahCost = bvh.ComputeSAHCost(traversalCost, intersectionCost);
+	stats.nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+	stats.primitiveReferenceCount = static_cast<uint32_t>(bvh.primitiveIndices.size());
+	stats.binaryMemorySize = bvh.nodes.size() * sizeof(LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t);
+
+	// Children are always stored after their parent, so depths are known by the time a node is reached.
+	std::vector<uint32_t> depths(stats.nodeCount, 0);
+
+	uint64_t leafDepthSum = 0;
+	double overlapSum = 0.0;
+
+	for (uint32_t i = 0; i < stats.nodeCount; i++)
+	{
+		const LinearBVHNode& node = nodeData[i];
+
+		if (node.IsLeaf())
+		{
+			stats.leafCount++;
+			stats.maxLeafSize = std::max<uint32_t>(stats.maxLeafSize, node.primitiveCount);
+
+			if (depths[i] >= stats.leafDepthHistogram.size())
+				stats.leafDepthHistogram.resize(depths[i] + 1, 0);
+
+			stats.leafDepthHistogram[depths[i]]++;
+			leafDepthSum += depths[i];
+			continue;
+		}
+
+		stats.interiorNodeCount++;
+
+		depths[node.offset] = depths[i] + 1;
+		depths[node.offset + 1] = depths[i] + 1;
+
+		AABB overlap = nodeData[node.offset].aabb;
+		overlap.Clip(nodeData[node.offset + 1].aabb);
+
+		const float surfaceArea = node.aabb.SurfaceArea();
+		if (!overlap.IsEmpty() && surfaceArea > 0.0f)
+			overlapSum += overlap.SurfaceArea() / surfaceArea;
+	}
+
+	stats.averageLeafDepth = static_cast<float>(static_cast<double>(leafDepthSum) / stats.leafCount);
+
+	if (stats.interiorNodeCount > 0)
+		stats.averageSiblingOverlap = static_cast<float>(overlapSum / stats.interiorNodeCount);
+
+	return stats;
+}
+
+// Traces rays through the binary BVH and counts the nodes they visit and the primitives they test, using the visit
+// counters of LinearBVH::BeginProfiling. Stops any profiling in progress.
+inline void EstimateBVHTraversal(LinearBVH& bvh, const std::vector<RayDesc>& rays, BVHStats& stats)
+{
+	stats.estimateRayCount = static_cast<uint32_t>(rays.size());
+	stats.nodesVisitedPerRay = 0.0f;
+	stats.primitivesTestedPerRay = 0.0f;
+
+	if (bvh.nodes.empty() || rays.empty())
+		return;
+
+	bvh.BeginProfiling();
+
+	for (const RayDesc& rayDesc : rays)
+	{
+		HitDesc hitDesc;
+		hitDesc.t = rayDesc.tmax;
+		bvh.Hit(rayDesc, hitDesc);
+	}
+
+	uint64_t nodesVisited = 0;
+	uint64_t primitivesTested = 0;
+
+	for (uint32_t i = 0; i < bvh.nodes.size(); i++)
+	{
+		const uint32_t visitCount = bvh.GetVisitCount(i);
+
+		nodesVisited += visitCount;
+		if (bvh.nodes.data()[i].IsLeaf())
+			primitivesTested += static_cast<uint64_t>(visitCount) * bvh.nodes.data()[i].primitiveCount;
+	}
+
+	bvh.EndProfiling();
+
+	stats.nodesVisitedPerRay = static_cast<float>(static_cast<double>(nodesVisited) / rays.size());
+	stats.primitivesTestedPerRay = static_cast<float>(static_cast<double>(primitivesTested) / rays.size());
+}
+
+inline void PrintBVHStats(const BVHStats& stats)
+{
+	printf("Build time: %.2f ms\n", stats.buildTime * 1000.0);
+
+	// Acceleration structures other than the BVH only report their build time and memory.
+	if (stats.nodeCount == 0)
+	{
+		printf("Memory: %.1f KB\n", stats.layoutMemorySize / 1024.0);
+		return;
+	}
+
+	printf("BVH SAH cost: %.2f\n", stats.sahCost);
+	printf("BVH nodes: %u (%u interior, %u leaves), %u primitive references, at most %u per leaf\n",
+		stats.nodeCount, stats.interiorNodeCount, stats.leafCount, stats.primitiveReferenceCount, stats.maxLeafSize);
+	printf("BVH average leaf depth: %.2f, max depth: %u\n", stats.averageLeafDepth, stats.leafDepthHistogram.empty() ? 0 : static_cast<uint32_t>(stats.leafDepthHistogram.size() - 1));
+	printf("BVH average sibling overlap: %.2f%%\n", stats.averageSiblingOverlap * 100.0f);
+	if (stats.layoutMemorySize > 0)
+		printf("BVH memory: %.1f KB binary, %.1f KB traversed layout\n", stats.binaryMemorySize / 1024.0, stats.layoutMemorySize / 1024.0);
+	else
+		printf("BVH memory: %.1f KB\n", stats.binaryMemorySize / 1024.0);
+
+	if (stats.estimateRayCount > 0)
+	{
+		printf("BVH traversal over %u rays: %.2f nodes visited and %.2f primitives tested per ray\n",
+			stats.estimateRayCount, stats.nodesVisitedPerRay, stats.primitivesTestedPerRay);
+	}
+
+	printf("BVH leaves per depth:\n");
+	for (size_t depth = 0; depth < stats.leafDepthHistogram.size(); depth++)
+	{
+		if (stats.leafDepthHistogram[depth] > 0)
+			printf("  %3u: %u\n", static_cast<uint32_t>(depth), stats.leafDepthHistogram[depth]);
+	}
+}
+
+#endif // BVH_STATS_H
@@ -0,0 +1,246 @@
+#ifndef BVH_TRIANGLE_LIST_H
+#define BVH_TRIANGLE_LIST_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "BVHLanes.h"
+#include "Ray.h"
+
+// Triangle vertices of a TriangleMesh BVH as structure of arrays in leaf order, so that the triangles of a leaf are
+// tested s_BVHLaneCount at a time with the watertight test of Woop et al., "Watertight Ray/Triangle Intersection",
+// 2013. Rays through a shared edge or vertex hit at least one of the triangles sharing it, so closed meshes have no
+// cracks. The test is done in the ray space where the ray goes along +z from the origin, with the vertices sheared.
+// That relies on the edge functions of a shared edge being exact negations, so their products must not be contracted
+// into FMAs. The kernel keeps them apart with BVHLanes::Unfused and, for MSVC, with the pragmas below, which hold even
+// with /fp:fast or -ffp-contract=fast. Builds that change them must keep contraction off for this file.
+#if defined(_MSC_VER)
+#pragma float_control(precise, on, push)
+#pragma fp_contract(off)
+#endif
+
+class BVHTriangleList : private BVHLanes
+{
+public:
+	void Clear()
+	{
+		for (int vertex = 0; vertex < 3; vertex++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				positions[vertex][axis].clear();
+			}
+		}
+	}
+
+	// The arrays are padded so that the kernel can load full registers at the end of the last leaf. Padding triangles
+	// are degenerate, which no ray hits.
+	void Resize(size_t count)
+	{
+		for (int vertex = 0; vertex < 3; vertex++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				positions[vertex][axis].resize(count + s_BVHLaneCount - 1, 0.0f);
+			}
+		}
+	}
+
+	void Set(size_t i, const Vector3f& p0, const Vector3f& p1, const Vector3f& p2)
+	{
+		const Vector3f* p[3] = { &p0, &p1, &p2 };
+		for (int vertex = 0; vertex < 3; vertex++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				positions[vertex][axis][i] = (*p[vertex])[axis];
+			}
+		}
+	}
+
+	size_t GetMemorySize() const
+	{
+		return positions[0][0].size() * 9 * sizeof(float);
+	}
+
+	// Tests the triangles [first, first + count). Returns the index of the closest hit in [rayDesc.tmin, rayDesc.tmax],
+	// shortens rayDesc.tmax to it and returns the barycentric coordinates of the second and third vertex.
+	bool Hit(uint32_t first, uint32_t count, RayDesc& rayDesc, uint32_t& hitIndex, float& b1, float& b2) const
+	{
+		const TriangleRay ray(rayDesc);
+
+		bool hitFound = false;
+
+		for (uint32_t i = first; i < first + count; i += s_BVHLaneCount)
+		{
+			const uint32_t laneCount = std::min<uint32_t>(first + count - i, s_BVHLaneCount);
+			const uint32_t laneMask = (1u << laneCount) - 1;
+
+			uint32_t hitLane;
+			if (HitLanes(ray, i, laneMask, rayDesc.tmin, rayDesc.tmax, hitLane, b1, b2))
+			{
+				hitFound = true;
+				hitIndex = i + hitLane;
+			}
+		}
+
+		return hitFound;
+	}
+
+private:
+	// Ray space of the test: kz is the axis the ray direction is largest along, and kx, ky are swapped for negative
+	// directions to keep the winding of the triangles. The shear maps the direction to (0, 0, 1).
+	struct TriangleRay
+	{
+		TriangleRay(const RayDesc& rayDesc)
+		{
+			const Vector3f& direction = rayDesc.ray.direction;
+
+			kz = 0;
+			for (int axis = 1; axis < 3; axis++)
+			{
+				if (fabsf(direction[axis]) > fabsf(direction[kz]))
+					kz = axis;
+			}
+			kx = (kz + 1) % 3;
+			ky = (kx + 1) % 3;
+			if (direction[kz] < 0.0f)
+				std::swap(kx, ky);
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				originLanes[axis] = Broadcast(rayDesc.ray.origin[axis]);
+			}
+			shearXLanes = Broadcast(direction[kx] / direction[kz]);
+			shearYLanes = Broadcast(direction[ky] / direction[kz]);
+			shearZLanes = Broadcast(1.0f / direction[kz]);
+		}
+
+		int		kx, ky, kz;
+		Lanes	originLanes[3];
+		Lanes	shearXLanes, shearYLanes, shearZLanes;
+	};
+
+	// Vertex relative to the ray origin and sheared into ray space. z is left unscaled, the scale is applied to the distance.
+	inline void LoadShearedVertex(const TriangleRay& ray, int vertex, uint32_t first, Lanes& x, Lanes& y, Lanes& z) const
+	{
+		const Lanes relativeX = Sub(Load(&positions[vertex][ray.kx][first]), ray.originLanes[ray.kx]);
+		const Lanes relativeY = Sub(Load(&positions[vertex][ray.ky][first]), ray.originLanes[ray.ky]);
+		z = Sub(Load(&positions[vertex][ray.kz][first]), ray.originLanes[ray.kz]);
+		x = Sub(relativeX, Unfused(Mul(ray.shearXLanes, z)));
+		y = Sub(relativeY, Unfused(Mul(ray.shearYLanes, z)));
+	}
+
+	// Triangles exactly on an edge in single precision are tested again in double precision, as in the paper, so that
+	// the sign of the edge functions stays consistent between the triangles sharing the edge. The sheared vertices are
+	// the ones of the single precision test, the products of two floats are exact in double whether fused or not.
+	static inline void RecomputeEdgesInDouble(const float x[3], const float y[3], float& u, float& v, float& w)
+	{
+		u = static_cast<float>(static_cast<double>(x[2]) * y[1] - static_cast<double>(y[2]) * x[1]);
+		v = static_cast<float>(static_cast<double>(x[0]) * y[2] - static_cast<double>(y[0]) * x[2]);
+		w = static_cast<float>(static_cast<double>(x[1]) * y[0] - static_cast<double>(y[1]) * x[0]);
+	}
+
+	// Tests the lanes of laneMask, starting at triangle first. Returns the lane of the closest hit in [tmin, tmax],
+	// shortens tmax to it and returns its barycentric coordinates.
+	inline bool HitLanes(const TriangleRay& ray, uint32_t first, uint32_t laneMask, float tmin, float& tmax, uint32_t& hitLane, float& b1, float& b2) const
+	{
+		Lanes ax, ay, az, bx, by, bz, cx, cy, cz;
+		LoadShearedVertex(ray, 0, first, ax, ay, az);
+		LoadShearedVertex(ray, 1, first, bx, by, bz);
+		LoadShearedVertex(ray, 2, first, cx, cy, cz);
+
+		// Scaled barycentric coordinates, the edge functions of the triangle in ray space.
+		Lanes u = Sub(Unfused(Mul(cx, by)), Unfused(Mul(cy, bx)));
+		Lanes v = Sub(Unfused(Mul(ax, cy)), Unfused(Mul(ay, cx)));
+		Lanes w = Sub(Unfused(Mul(bx, ay)), Unfused(Mul(by, ax)));
+
+		const Lanes zero = Broadcast(0.0f);
+
+		uint32_t onEdgeMask = static_cast<uint32_t>(MoveMask(Or(Or(Equal(u, zero), Equal(v, zero)), Equal(w, zero)))) & laneMask;
+		if (onEdgeMask != 0)
+		{
+			float us[s_BVHLaneCount], vs[s_BVHLaneCount], ws[s_BVHLaneCount];
+			Store(us, u);
+			Store(vs, v);
+			Store(ws, w);
+
+			float xs[3][s_BVHLaneCount], ys[3][s_BVHLaneCount];
+			Store(xs[0], ax);
+			Store(xs[1], bx);
+			Store(xs[2], cx);
+			Store(ys[0], ay);
+			Store(ys[1], by);
+			Store(ys[2], cy);
+
+			while (onEdgeMask != 0)
+			{
+				const uint32_t lane = BitScanForward(onEdgeMask);
+				onEdgeMask &= onEdgeMask - 1;
+
+				const float x[3] = { xs[0][lane], xs[1][lane], xs[2][lane] };
+				const float y[3] = { ys[0][lane], ys[1][lane], ys[2][lane] };
+				RecomputeEdgesInDouble(x, y, us[lane], vs[lane], ws[lane]);
+			}
+
+			u = Load(us);
+			v = Load(vs);
+			w = Load(ws);
+		}
+
+		// The ray misses when the edge functions have different signs, triangles of either winding are hit.
+		const Lanes anyNegative = Or(Or(Less(u, zero), Less(v, zero)), Less(w, zero));
+		const Lanes anyPositive = Or(Or(Greater(u, zero), Greater(v, zero)), Greater(w, zero));
+		const Lanes determinant = Add(Add(u, v), w);
+
+		uint32_t mask = ~static_cast<uint32_t>(MoveMask(And(anyNegative, anyPositive))) & static_cast<uint32_t>(MoveMask(NotEqual(determinant, zero))) & laneMask;
+		if (mask == 0)
+			return false;
+
+		// Distance scaled by the determinant, compared against the range scaled the same way to avoid the division.
+		const Lanes scaledT = Mul(ray.shearZLanes, Add(Add(Mul(u, az), Mul(v, bz)), Mul(w, cz)));
+		const Lanes determinantSign = And(determinant, SignMask());
+		const Lanes signedT = Xor(scaledT, determinantSign);
+		const Lanes absDeterminant = Xor(determinant, determinantSign);
+		const Lanes inRange = And(GreaterEqual(signedT, Mul(Broadcast(tmin), absDeterminant)), LessEqual(signedT, Mul(Broadcast(tmax), absDeterminant)));
+
+		mask &= static_cast<uint32_t>(MoveMask(inRange));
+		if (mask == 0)
+			return false;
+
+		float ts[s_BVHLaneCount];
+		Store(ts, Div(scaledT, determinant));
+
+		hitLane = BitScanForward(mask);
+		mask &= mask - 1;
+		while (mask != 0)
+		{
+			const uint32_t lane = BitScanForward(mask);
+			mask &= mask - 1;
+
+			if (ts[lane] < ts[hitLane])
+				hitLane = lane;
+		}
+
+		float vs[s_BVHLaneCount], ws[s_BVHLaneCount], determinants[s_BVHLaneCount];
+		Store(vs, v);
+		Store(ws, w);
+		Store(determinants, determinant);
+
+		const float invDeterminant = 1.0f / determinants[hitLane];
+		b1 = vs[hitLane] * invDeterminant;
+		b2 = ws[hitLane] * invDeterminant;
+
+		tmax = ts[hitLane];
+		return true;
+	}
+
+	std::vector<float>	positions[3][3];	// Per vertex of the triangle, per axis.
+};
+
+#if defined(_MSC_VER)
+#pragma float_control(pop)
+#endif
+
+#endif // BVH_TRIANGLE_LIST_H
@@ -0,0 +1,109 @@
+#ifndef BOX_H
+#define BOX_H
+
+#include "Geometry.h"
+#include "Vector3f.h"
+#include "Material.h"
+
+// Axis-aligned box, tested with a single slab test instead of six quads. Rays starting inside hit the face they leave
+// through, from the back. UVs are the coordinates of the hit across the face, in [0, 1]. Flat boxes, with min == max
+// on some axis, are allowed: the coordinate along a flat axis is 0.
+class Box : public Geometry
+{
+public:
+	Box(shared_ptr<Material> material, const Vector3f& min, const Vector3f& max)
+	{
+		this->material = material;
+		this->min = Min(min, max);
+		this->max = Max(min, max);
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		const Vector3f& origin = rayDesc.ray.origin;
+		const Vector3f& direction = rayDesc.ray.direction;
+
+		float tEntry = -infinity;
+		float tExit = infinity;
+		int entryAxis = 0;
+		int exitAxis = 0;
+
+		// NaNs (0 * inf for rays lying in a slab plane) fail the comparisons and are skipped.
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float invDirection = 1.0f / direction[axis];
+			float t0 = (min[axis] - origin[axis]) * invDirection;
+			float t1 = (max[axis] - origin[axis]) * invDirection;
+			if (invDirection < 0.0f)
+				std::swap(t0, t1);
+
+			if (t0 > tEntry)
+			{
+				tEntry = t0;
+				entryAxis = axis;
+			}
+			if (t1 < tExit)
+			{
+				tExit = t1;
+				exitAxis = axis;
+			}
+		}
+
+		if (tEntry > tExit)
+			return false;
+
+		float t;
+		int axis;
+		Vector3f outwardNormal(0, 0, 0);
+
+		if (tEntry >= rayDesc.tmin && tEntry <= rayDesc.tmax)
+		{
+			t = tEntry;
+			axis = entryAxis;
+			outwardNormal[axis] = (direction[axis] < 0.0f) ? 1.0f : -1.0f;
+		}
+		else if (tExit >= rayDesc.tmin && tExit <= rayDesc.tmax)
+		{
+			t = tExit;
+			axis = exitAxis;
+			outwardNormal[axis] = (direction[axis] < 0.0f) ? -1.0f : 1.0f;
+		}
+		else
+		{
+			return false;
+		}
+
+		hitDesc.t = t;
+		hitDesc.position = rayDesc.ray.At(t);
+		hitDesc.SetFaceNormal(rayDesc.ray, outwardNormal);
+
+		const int axisU = (axis + 1) % 3;
+		const int axisV = (axis + 2) % 3;
+		hitDesc.u = FaceCoordinate(hitDesc.position, axisU);
+		hitDesc.v = FaceCoordinate(hitDesc.position, axisV);
+
+		hitDesc.material = material.get();
+		hitDesc.instanceID = 0;
+
+		return true;
+	}
+
+	virtual void GetBoundingBox(AABB& aabb) const override
+	{
+		aabb = AABB(min, max);
+	}
+
+private:
+	inline float FaceCoordinate(const Vector3f& position, int axis) const
+	{
+		const float extent = max[axis] - min[axis];
+		return (extent > 0.0f) ? (position[axis] - min[axis]) / extent : 0.0f;
+	}
+
+public:
+	Vector3f min;
+	Vector3f max;
+	shared_ptr<Material> material;
+};
+
+#endif
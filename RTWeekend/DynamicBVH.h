@@ -0,0 +1,496 @@
+#ifndef DYNAMIC_BVH_H
+#define DYNAMIC_BVH_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "AccelerationStructure.h"
+#include "LinearBVH.h"
+
+const uint32_t s_DynamicBVHNull = 0xFFFFFFFF;
+
+// Node of a BVH whose nodes can be allocated and freed in any order. Every leaf holds a single geometry.
+struct DynamicBVHNode
+{
+	inline bool IsLeaf() const { return child[0] == s_DynamicBVHNull; }
+
+	AABB		aabb;
+	uint32_t	parent;		// s_DynamicBVHNull for the root. Next free node while on the free list.
+	uint32_t	child[2];	// s_DynamicBVHNull for leaves.
+	uint32_t	height;		// 0 for leaves.
+};
+
+// Binary BVH supporting insertion and removal of single geometries, for interactive edits.
+// Build starts from a binned SAH build. Insert then looks for the sibling that increases the total surface area of the
+// tree the least with a branch and bound search, as in Box2D's dynamic tree. Insertions and removals refit the
+// ancestors and rotate them: a child is swapped with a grandchild when that shrinks the surface area of the node in
+// between, Kopta et al., "Fast, Effective BVH Updates for Animated Scenes", 2012.
+// Traversal is the same as LinearBVH, but siblings are not adjacent in memory, so the static BVH is faster to trace once
+// edits are over.
+class DynamicBVH : public AccelerationStructure
+{
+public:
+	virtual AccelerationStructureType GetType() const override
+	{
+		return AccelerationStructureType::DynamicBVH;
+	}
+
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) override
+	{
+		Clear();
+
+		if (geometries.empty())
+			return;
+
+		// Every geometry needs a leaf of its own to be removable, so no multi-primitive leaves nor spatial splits.
+		BVHBuildSettings builderSettings = settings;
+		builderSettings.maxLeafSize = 1;
+		if (builderSettings.mode == BVHBuildMode::SBVH)
+			builderSettings.mode = BVHBuildMode::SAH;
+
+		BVHBuilder builder(geometries, builderSettings);
+		builder.Build();
+
+		nodes.reserve(builder.nodes.size());
+		primitives.Resize(builder.nodes.size());
+
+		root = Convert(geometries, builder, 0, s_DynamicBVHNull);
+	}
+
+	virtual void Clear() override
+	{
+		nodes.clear();
+		primitives.Clear();
+		leaves.clear();
+		root = s_DynamicBVHNull;
+		freeList = s_DynamicBVHNull;
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		if (root == s_DynamicBVHNull)
+			return false;
+
+		const DynamicBVHNode* nodeData = nodes.data();
+
+		const TraversalRay ray(rayDesc.ray);
+
+		float tEntry;
+		if (!nodeData[root].aabb.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry))
+			return false;
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		bool hitFound = false;
+		PrimitiveHit closestHit;
+
+		struct StackEntry
+		{
+			uint32_t	nodeIndex;
+			float		tEntry;
+		};
+
+		StackEntry stack[s_BVHStackSize];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = root;
+
+		while (true)
+		{
+			const DynamicBVHNode& node = nodeData[nodeIndex];
+
+			if (node.IsLeaf())
+			{
+				if (primitives.Hit(nodeIndex, 1, tempRayDesc, hitDesc, closestHit))
+					hitFound = true;
+			}
+			else
+			{
+				float tEntryLeft, tEntryRight;
+				bool hitLeft = nodeData[node.child[0]].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryLeft);
+				bool hitRight = nodeData[node.child[1]].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryRight);
+
+				if (hitLeft && hitRight)
+				{
+					if (tEntryLeft <= tEntryRight)
+					{
+						stack[stackSize++] = { node.child[1], tEntryRight };
+						nodeIndex = node.child[0];
+					}
+					else
+					{
+						stack[stackSize++] = { node.child[0], tEntryLeft };
+						nodeIndex = node.child[1];
+					}
+					continue;
+				}
+				else if (hitLeft)
+				{
+					nodeIndex = node.child[0];
+					continue;
+				}
+				else if (hitRight)
+				{
+					nodeIndex = node.child[1];
+					continue;
+				}
+			}
+
+			// Pop the next subtree that can still contain a closer hit.
+			do
+			{
+				if (stackSize == 0)
+				{
+					closestHit.Resolve(tempRayDesc, hitDesc);
+					return hitFound;
+				}
+
+				stackSize--;
+			}
+			while (stack[stackSize].tEntry > tempRayDesc.tmax);
+
+			nodeIndex = stack[stackSize].nodeIndex;
+		}
+	}
+
+	// Recomputes all bounds from the current geometry bounds, keeping the tree topology.
+	virtual bool Refit() override
+	{
+		if (root != s_DynamicBVHNull)
+			RefitRecursive(root);
+
+		return true;
+	}
+
+	// Returns false once the tree is too deep for the traversal stack, the scene is rebuilt then.
+	virtual bool Insert(const Geometry* geometry) override
+	{
+		const uint32_t leaf = AllocateNode();
+		nodes[leaf].child[0] = s_DynamicBVHNull;
+		nodes[leaf].child[1] = s_DynamicBVHNull;
+		nodes[leaf].height = 0;
+		geometry->GetBoundingBox(nodes[leaf].aabb);
+
+		primitives.Set(leaf, geometry);
+		leaves[geometry] = leaf;
+
+		InsertLeaf(leaf);
+
+		return nodes[root].height < s_BVHStackSize;
+	}
+
+	virtual bool Remove(const Geometry* geometry) override
+	{
+		auto it = leaves.find(geometry);
+		if (it == leaves.end())
+			return false;
+
+		const uint32_t leaf = it->second;
+		leaves.erase(it);
+
+		RemoveLeaf(leaf);
+
+		primitives.Set(leaf, nullptr);
+		FreeNode(leaf);
+
+		return true;
+	}
+
+	// Reinserts the geometry, which finds it a better place in the tree than refitting its ancestors.
+	virtual bool UpdateGeometry(const Geometry* geometry) override
+	{
+		auto it = leaves.find(geometry);
+		if (it == leaves.end())
+			return false;
+
+		const uint32_t leaf = it->second;
+
+		RemoveLeaf(leaf);
+
+		geometry->GetBoundingBox(nodes[leaf].aabb);
+		primitives.Set(leaf, geometry);
+
+		InsertLeaf(leaf);
+
+		return nodes[root].height < s_BVHStackSize;
+	}
+
+	virtual size_t GetMemorySize() const override
+	{
+		return nodes.size() * sizeof(DynamicBVHNode) + primitives.GetMemorySize();
+	}
+
+private:
+	uint32_t Convert(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuilder& builder, uint32_t buildIndex, uint32_t parent)
+	{
+		const BVHBuildNode& buildNode = builder.nodes[buildIndex];
+
+		const uint32_t index = AllocateNode();
+		nodes[index].aabb = buildNode.aabb;
+		nodes[index].parent = parent;
+
+		if (buildNode.IsLeaf())
+		{
+			const Geometry* geometry = geometries[builder.primitiveIndices[buildNode.offset]].get();
+
+			nodes[index].child[0] = s_DynamicBVHNull;
+			nodes[index].child[1] = s_DynamicBVHNull;
+			nodes[index].height = 0;
+
+			primitives.Set(index, geometry);
+			leaves[geometry] = index;
+
+			return index;
+		}
+
+		const uint32_t left = Convert(geometries, builder, buildNode.offset, index);
+		const uint32_t right = Convert(geometries, builder, buildNode.offset + 1, index);
+
+		nodes[index].child[0] = left;
+		nodes[index].child[1] = right;
+		nodes[index].height = 1 + std::max<uint32_t>(nodes[left].height, nodes[right].height);
+
+		return index;
+	}
+
+	uint32_t AllocateNode()
+	{
+		if (freeList == s_DynamicBVHNull)
+		{
+			nodes.emplace_back();
+			primitives.Resize(std::max<size_t>(primitives.size(), nodes.size()));
+			return static_cast<uint32_t>(nodes.size() - 1);
+		}
+
+		const uint32_t index = freeList;
+		freeList = nodes[index].parent;
+		return index;
+	}
+
+	void FreeNode(uint32_t index)
+	{
+		nodes[index].parent = freeList;
+		nodes[index].height = 0;
+		freeList = index;
+	}
+
+	void InsertLeaf(uint32_t leaf)
+	{
+		if (root == s_DynamicBVHNull)
+		{
+			root = leaf;
+			nodes[leaf].parent = s_DynamicBVHNull;
+			return;
+		}
+
+		const AABB leafAABB = nodes[leaf].aabb;
+		const uint32_t sibling = FindBestSibling(leafAABB);
+
+		// The new parent takes the place of the sibling.
+		const uint32_t oldParent = nodes[sibling].parent;
+		const uint32_t newParent = AllocateNode();
+
+		AABB aabb = nodes[sibling].aabb;
+		aabb.Encapsulate(leafAABB);
+
+		nodes[newParent].aabb = aabb;
+		nodes[newParent].parent = oldParent;
+		nodes[newParent].child[0] = sibling;
+		nodes[newParent].child[1] = leaf;
+		nodes[newParent].height = nodes[sibling].height + 1;
+
+		if (oldParent == s_DynamicBVHNull)
+			root = newParent;
+		else
+			nodes[oldParent].child[nodes[oldParent].child[0] == sibling ? 0 : 1] = newParent;
+
+		nodes[sibling].parent = newParent;
+		nodes[leaf].parent = newParent;
+
+		RefitAncestors(oldParent);
+	}
+
+	// Detaches the leaf and frees its parent, the sibling taking the place of the parent.
+	void RemoveLeaf(uint32_t leaf)
+	{
+		if (leaf == root)
+		{
+			root = s_DynamicBVHNull;
+			return;
+		}
+
+		const uint32_t parent = nodes[leaf].parent;
+		const uint32_t grandParent = nodes[parent].parent;
+		const uint32_t sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+
+		if (grandParent == s_DynamicBVHNull)
+		{
+			root = sibling;
+			nodes[sibling].parent = s_DynamicBVHNull;
+		}
+		else
+		{
+			nodes[grandParent].child[nodes[grandParent].child[0] == parent ? 0 : 1] = sibling;
+			nodes[sibling].parent = grandParent;
+		}
+
+		FreeNode(parent);
+
+		RefitAncestors(grandParent);
+	}
+
+	// Branch and bound over the tree: the cost of a sibling is the area of its box grown by the leaf, plus the area its
+	// ancestors grow by. A subtree is skipped once even the leaf box alone cannot beat the best cost found.
+	uint32_t FindBestSibling(const AABB& leafAABB)
+	{
+		const float leafArea = leafAABB.SurfaceArea();
+
+		uint32_t bestSibling = root;
+		AABB rootAABB = nodes[root].aabb;
+		rootAABB.Encapsulate(leafAABB);
+		float bestCost = rootAABB.SurfaceArea();
+
+		candidates.clear();
+		candidates.push_back({ root, 0.0f });
+
+		while (!candidates.empty())
+		{
+			const Candidate candidate = candidates.back();
+			candidates.pop_back();
+
+			const DynamicBVHNode& node = nodes[candidate.nodeIndex];
+
+			AABB combined = node.aabb;
+			combined.Encapsulate(leafAABB);
+			const float combinedArea = combined.SurfaceArea();
+
+			const float cost = combinedArea + candidate.inheritedCost;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSibling = candidate.nodeIndex;
+			}
+
+			if (node.IsLeaf())
+				continue;
+
+			const float inheritedCost = candidate.inheritedCost + combinedArea - node.aabb.SurfaceArea();
+			if (leafArea + inheritedCost < bestCost)
+			{
+				candidates.push_back({ node.child[0], inheritedCost });
+				candidates.push_back({ node.child[1], inheritedCost });
+			}
+		}
+
+		return bestSibling;
+	}
+
+	void RefitAncestors(uint32_t index)
+	{
+		while (index != s_DynamicBVHNull)
+		{
+			Rotate(index);
+			RefitNode(index);
+			index = nodes[index].parent;
+		}
+	}
+
+	void RefitNode(uint32_t index)
+	{
+		DynamicBVHNode& node = nodes[index];
+		const DynamicBVHNode& left = nodes[node.child[0]];
+		const DynamicBVHNode& right = nodes[node.child[1]];
+
+		node.aabb = left.aabb;
+		node.aabb.Encapsulate(right.aabb);
+		node.height = 1 + std::max<uint32_t>(left.height, right.height);
+	}
+
+	// Swaps a child of the node with a grandchild on the other side when that shrinks the child the grandchild leaves.
+	// The node bounds stay the same, so nothing above it changes.
+	void Rotate(uint32_t index)
+	{
+		const uint32_t b = nodes[index].child[0];
+		const uint32_t c = nodes[index].child[1];
+
+		float bestGain = 0.0f;
+		uint32_t bestChild = s_DynamicBVHNull;
+		uint32_t bestGrandChild = s_DynamicBVHNull;
+
+		auto consider = [&](uint32_t child, uint32_t otherChild)
+		{
+			if (nodes[otherChild].IsLeaf())
+				return;
+
+			const float area = nodes[otherChild].aabb.SurfaceArea();
+
+			for (int i = 0; i < 2; i++)
+			{
+				// child moves down next to the grandchild that stays.
+				AABB rotated = nodes[child].aabb;
+				rotated.Encapsulate(nodes[nodes[otherChild].child[1 - i]].aabb);
+
+				const float gain = area - rotated.SurfaceArea();
+				if (gain > bestGain)
+				{
+					bestGain = gain;
+					bestChild = child;
+					bestGrandChild = nodes[otherChild].child[i];
+				}
+			}
+		};
+
+		consider(b, c);
+		consider(c, b);
+
+		if (bestChild == s_DynamicBVHNull)
+			return;
+
+		const uint32_t otherChild = nodes[bestGrandChild].parent;
+
+		nodes[index].child[nodes[index].child[0] == bestChild ? 0 : 1] = bestGrandChild;
+		nodes[bestGrandChild].parent = index;
+
+		nodes[otherChild].child[nodes[otherChild].child[0] == bestGrandChild ? 0 : 1] = bestChild;
+		nodes[bestChild].parent = otherChild;
+
+		RefitNode(otherChild);
+	}
+
+	void RefitRecursive(uint32_t index)
+	{
+		DynamicBVHNode& node = nodes[index];
+
+		if (node.IsLeaf())
+		{
+			const Geometry* geometry = primitives[index];
+			geometry->GetBoundingBox(node.aabb);
+			primitives.Set(index, geometry);
+			return;
+		}
+
+		RefitRecursive(node.child[0]);
+		RefitRecursive(node.child[1]);
+		RefitNode(index);
+	}
+
+public:
+	std::vector<DynamicBVHNode>		nodes;
+	BVHPrimitives					primitives;	// Indexed by node, only set for leaves.
+	uint32_t						root = s_DynamicBVHNull;
+
+private:
+	uint32_t										freeList = s_DynamicBVHNull;
+	std::unordered_map<const Geometry*, uint32_t>	leaves;		// Leaf node of every geometry.
+
+	struct Candidate
+	{
+		uint32_t	nodeIndex;
+		float		inheritedCost;	// Area the ancestors of the node grow by to contain the inserted leaf.
+	};
+
+	std::vector<Candidate>							candidates;	// Search stack of FindBestSibling, kept to avoid allocations.
+};
+
+#endif // DYNAMIC_BVH_H
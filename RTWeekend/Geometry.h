@@ -21,6 +21,16 @@ struct HitDesc
 	float v;
 	float t;
 	bool frontFace;
+	uint32_t instanceID = 0;	// InstanceID of the instance that was hit, 0 for geometries that are not instanced.
+};
+
+// Acceleration structure leaves store their primitives grouped by type, in this order. Spheres are tested from
+// compact copies in the leaves instead of through Geometry::Hit.
+enum class GeometryType : uint8_t
+{
+	Sphere,
+	Instance,
+	Other,
 };
 
 class Geometry
@@ -28,6 +38,26 @@ class Geometry
 public:
 	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const = 0;
 	virtual void GetBoundingBox(AABB& aabb) const = 0;
+
+	virtual GeometryType GetType() const
+	{
+		return GeometryType::Other;
+	}
+
+	// Unbounded geometries, such as infinite planes, have no meaningful bounding box. A Scene keeps them out of its
+	// acceleration structure and tests them against every ray instead.
+	virtual bool IsBounded() const
+	{
+		return true;
+	}
+
+	// Bounds of the part of the geometry inside clip, empty if there is none. Spatial splits use this to cut large
+	// primitives into smaller boxes. The default clips the whole bounding box, which is conservative but loose.
+	virtual void GetClippedBoundingBox(const AABB& clip, AABB& aabb) const
+	{
+		GetBoundingBox(aabb);
+		aabb.Clip(clip);
+	}
 };
 
 #endif // GEOMETRY_H
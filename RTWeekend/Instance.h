@@ -0,0 +1,106 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "Geometry.h"
+#include "Matrix3x4.h"
+#include "Scene.h"
+
+// Geometry in object space with its own acceleration structure, built once and shared by any number of instances.
+class BottomLevelAccelerationStructure
+{
+public:
+	void Add(shared_ptr<Geometry> geometry)
+	{
+		scene.Add(geometry);
+	}
+
+	void Build(const BVHBuildSettings& settings = BVHBuildSettings())
+	{
+		scene.BuildAccelerationStructure(settings);
+
+		aabb = AABB::Empty();
+		for (const auto& geometry : scene.boundedGeometries)
+		{
+			AABB geometryAABB;
+			geometry->GetBoundingBox(geometryAABB);
+			aabb.Encapsulate(geometryAABB);
+		}
+	}
+
+	inline bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		return scene.Hit(rayDesc, hitDesc);
+	}
+
+public:
+	Scene	scene;
+	AABB	aabb;	// Object space bounds of all bounded geometries.
+};
+
+// Placement of a bottom-level acceleration structure in the scene, similar to D3D12_RAYTRACING_INSTANCE_DESC.
+// Instances are regular geometries of the top-level scene, so the scene BVH over them is the top-level acceleration
+// structure and only that one needs to be rebuilt or refitted when instances move.
+class Instance : public Geometry
+{
+public:
+	Instance(shared_ptr<BottomLevelAccelerationStructure> blas, const Matrix3x4& transform, uint32_t instanceID = 0, uint8_t instanceMask = 0xFF)
+	{
+		this->blas = blas;
+		this->instanceID = instanceID;
+		this->instanceMask = instanceMask;
+
+		SetTransform(transform);
+	}
+
+	void SetTransform(const Matrix3x4& transform)
+	{
+		objectToWorld = transform;
+		worldToObject = transform.Inverse();
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		if ((instanceMask & rayDesc.instanceInclusionMask) == 0)
+			return false;
+
+		// The object space direction is not normalized, so hit distances are the same in both spaces.
+		RayDesc objectRayDesc = rayDesc;
+		objectRayDesc.ray.origin = worldToObject.TransformPoint(rayDesc.ray.origin);
+		objectRayDesc.ray.direction = worldToObject.TransformVector(rayDesc.ray.direction);
+
+		if (!blas->Hit(objectRayDesc, hitDesc))
+			return false;
+
+		// Normals transform with the inverse transpose. The transform keeps the sign of Dot(direction, normal), so frontFace is still valid.
+		hitDesc.position = rayDesc.ray.At(hitDesc.t);
+		hitDesc.normal = Normalize(worldToObject.TransformNormalTransposed(hitDesc.normal));
+		hitDesc.instanceID = instanceID;
+
+		return true;
+	}
+
+	virtual GeometryType GetType() const override
+	{
+		return GeometryType::Instance;
+	}
+
+	// Instances of structures with unbounded geometries are tested against every ray of the top-level scene too.
+	virtual bool IsBounded() const override
+	{
+		return blas->scene.unboundedGeometries.empty();
+	}
+
+	virtual void GetBoundingBox(AABB& aabb) const override
+	{
+		aabb = objectToWorld.TransformAABB(blas->aabb);
+	}
+
+public:
+	shared_ptr<BottomLevelAccelerationStructure>	blas;
+	Matrix3x4										objectToWorld;
+	Matrix3x4										worldToObject;
+	uint32_t										instanceID;
+	uint8_t											instanceMask;
+};
+
+#endif // INSTANCE_H
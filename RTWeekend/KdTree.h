@@ -0,0 +1,319 @@
+#ifndef KD_TREE_H
+#define KD_TREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "AccelerationStructure.h"
+
+// 8 byte k-d tree node. The child below the split plane follows its parent, the one above is stored anywhere after it.
+struct KdTreeNode
+{
+	static const uint32_t s_KdTreeLeaf = 3;
+
+	inline bool IsLeaf() const { return (flags & 3) == s_KdTreeLeaf; }
+	inline int Axis() const { return static_cast<int>(flags & 3); }
+	inline uint32_t AboveChild() const { return flags >> 2; }
+	inline uint32_t PrimitiveCount() const { return flags >> 2; }
+
+	union
+	{
+		float		split;			// Interior: position of the split plane.
+		uint32_t	firstPrimitive;	// Leaf.
+	};
+	uint32_t		flags;			// Split axis, or s_KdTreeLeaf, in the low 2 bits. Above child index or primitive count in the others.
+};
+
+static_assert(sizeof(KdTreeNode) == 8, "KdTreeNode is expected to be 8 bytes.");
+
+const uint32_t s_KdTreeMaxDepth = 64;
+
+// SAH k-d tree, Wald and Havran, "On building fast kd-trees for ray tracing, and on doing that in O(N log N)", 2006,
+// built with the simpler O(N log^2 N) sort per node. Geometries are clipped to the node bounds with
+// Geometry::GetClippedBoundingBox before evaluating the split planes, and listed in every leaf they overlap.
+// Splits cut off empty space more aggressively than a BVH, at the cost of references to the same geometry in several leaves.
+class KdTree : public AccelerationStructure
+{
+public:
+	virtual AccelerationStructureType GetType() const override
+	{
+		return AccelerationStructureType::KdTree;
+	}
+
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) override
+	{
+		Clear();
+
+		const uint32_t geometryCount = static_cast<uint32_t>(geometries.size());
+		if (geometryCount == 0)
+			return;
+
+		std::vector<uint32_t> geometryIndices(geometryCount);
+
+		bounds = AABB::Empty();
+		for (uint32_t i = 0; i < geometryCount; i++)
+		{
+			AABB aabb;
+			geometries[i]->GetBoundingBox(aabb);
+			bounds.Encapsulate(aabb);
+			geometryIndices[i] = i;
+		}
+
+		// Depth limit from Wald and Havran, it stops the tree from splitting clusters of geometries that overlap everywhere.
+		const uint32_t maxDepth = std::min<uint32_t>(static_cast<uint32_t>(8.0f + 1.3f * std::log2(static_cast<float>(geometryCount))), s_KdTreeMaxDepth - 1);
+
+		std::vector<uint32_t> indices;
+		BuildRecursive(geometries, settings, bounds, geometryIndices, maxDepth, indices);
+
+		primitives.Build(geometries, indices.data(), indices.size());
+	}
+
+	virtual void Clear() override
+	{
+		nodes.clear();
+		primitives.Clear();
+	}
+
+	// Visits the leaves front to back. A leaf is only entered while the closest hit found so far is beyond its entry distance.
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		if (nodes.empty())
+			return false;
+
+		const TraversalRay ray(rayDesc.ray);
+
+		float tEntry, tExit;
+		if (!bounds.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry, tExit))
+			return false;
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		bool hitFound = false;
+		PrimitiveHit closestHit;
+
+		struct StackEntry
+		{
+			uint32_t	nodeIndex;
+			float		tEntry;
+			float		tExit;
+		};
+
+		StackEntry stack[s_KdTreeMaxDepth];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = 0;
+
+		while (true)
+		{
+			if (tEntry > tempRayDesc.tmax)
+			{
+				closestHit.Resolve(tempRayDesc, hitDesc);
+				return hitFound;
+			}
+
+			const KdTreeNode& node = nodes[nodeIndex];
+
+			if (!node.IsLeaf())
+			{
+				const int axis = node.Axis();
+				const float origin = rayDesc.ray.origin[axis];
+				const float tPlane = (node.split - origin) * ray.invDirection[axis];
+
+				const bool belowFirst = (origin < node.split) || (origin == node.split && rayDesc.ray.direction[axis] <= 0.0f);
+				const uint32_t firstChild = belowFirst ? nodeIndex + 1 : node.AboveChild();
+				const uint32_t secondChild = belowFirst ? node.AboveChild() : nodeIndex + 1;
+
+				// The comparisons are written so that a NaN plane distance (ray in the plane) only visits the first child.
+				if (!(tPlane > 0.0f) || tPlane > tExit)
+				{
+					nodeIndex = firstChild;
+				}
+				else if (tPlane < tEntry)
+				{
+					nodeIndex = secondChild;
+				}
+				else
+				{
+					stack[stackSize++] = { secondChild, tPlane, tExit };
+					nodeIndex = firstChild;
+					tExit = tPlane;
+				}
+				continue;
+			}
+
+			const uint32_t count = node.PrimitiveCount();
+			if (count > 0 && primitives.Hit(node.firstPrimitive, count, tempRayDesc, hitDesc, closestHit))
+				hitFound = true;
+
+			if (stackSize == 0)
+			{
+				closestHit.Resolve(tempRayDesc, hitDesc);
+				return hitFound;
+			}
+
+			stackSize--;
+			nodeIndex = stack[stackSize].nodeIndex;
+			tEntry = stack[stackSize].tEntry;
+			tExit = stack[stackSize].tExit;
+		}
+	}
+
+	virtual size_t GetMemorySize() const override
+	{
+		return nodes.size() * sizeof(KdTreeNode) + primitives.GetMemorySize();
+	}
+
+private:
+	struct Event
+	{
+		float		position;
+		bool		end;	// Starts sort first at the same position, so flat boxes are counted on both sides.
+
+		bool operator<(const Event& other) const
+		{
+			return (position < other.position) || (position == other.position && !end && other.end);
+		}
+	};
+
+	void BuildRecursive(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings, const AABB& nodeBounds,
+		const std::vector<uint32_t>& nodeGeometries, uint32_t depth, std::vector<uint32_t>& indices)
+	{
+		const uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+
+		// Parts of the geometries inside the node, geometries that do not reach into it are dropped.
+		std::vector<uint32_t> clippedGeometries;
+		std::vector<AABB> clippedBounds;
+		clippedGeometries.reserve(nodeGeometries.size());
+		clippedBounds.reserve(nodeGeometries.size());
+
+		for (uint32_t geometry : nodeGeometries)
+		{
+			AABB aabb;
+			geometries[geometry]->GetClippedBoundingBox(nodeBounds, aabb);
+			if (aabb.IsEmpty())
+				continue;
+
+			aabb.Clip(nodeBounds);
+			clippedGeometries.push_back(geometry);
+			clippedBounds.push_back(aabb);
+		}
+
+		const uint32_t count = static_cast<uint32_t>(clippedGeometries.size());
+
+		int bestAxis = -1;
+		float bestSplit = 0.0f;
+
+		if (count > 1 && depth > 0)
+			FindSplit(settings, nodeBounds, clippedBounds, bestAxis, bestSplit);
+
+		if (bestAxis == -1)
+		{
+			nodes[nodeIndex].firstPrimitive = static_cast<uint32_t>(indices.size());
+			nodes[nodeIndex].flags = (count << 2) | KdTreeNode::s_KdTreeLeaf;
+			indices.insert(indices.end(), clippedGeometries.begin(), clippedGeometries.end());
+			return;
+		}
+
+		std::vector<uint32_t> below;
+		std::vector<uint32_t> above;
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			const AABB& aabb = clippedBounds[i];
+			const bool flat = aabb.min[bestAxis] == bestSplit && aabb.max[bestAxis] == bestSplit;
+
+			if (aabb.min[bestAxis] < bestSplit || flat)
+				below.push_back(clippedGeometries[i]);
+			if (aabb.max[bestAxis] > bestSplit || flat)
+				above.push_back(clippedGeometries[i]);
+		}
+
+		clippedGeometries = std::vector<uint32_t>();
+		clippedBounds = std::vector<AABB>();
+
+		AABB belowBounds = nodeBounds;
+		AABB aboveBounds = nodeBounds;
+		belowBounds.max[bestAxis] = bestSplit;
+		aboveBounds.min[bestAxis] = bestSplit;
+
+		BuildRecursive(geometries, settings, belowBounds, below, depth - 1, indices);
+
+		const uint32_t aboveChild = static_cast<uint32_t>(nodes.size());
+		BuildRecursive(geometries, settings, aboveBounds, above, depth - 1, indices);
+
+		nodes[nodeIndex].split = bestSplit;
+		nodes[nodeIndex].flags = (aboveChild << 2) | static_cast<uint32_t>(bestAxis);
+	}
+
+	// Sweeps the sorted box edges of every axis. Leaves bestAxis at -1 if no plane is cheaper than a leaf.
+	void FindSplit(const BVHBuildSettings& settings, const AABB& nodeBounds, const std::vector<AABB>& clippedBounds, int& bestAxis, float& bestSplit)
+	{
+		const uint32_t count = static_cast<uint32_t>(clippedBounds.size());
+		const float invArea = 1.0f / nodeBounds.SurfaceArea();
+		const Vector3f extent = nodeBounds.Extent();
+
+		// Splits cutting off empty space are favored, as in the PBRT k-d tree.
+		const float emptyBonus = 0.2f;
+
+		float bestCost = settings.intersectionCost * count;
+
+		std::vector<Event> events(2 * count);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (!(extent[axis] > 0.0f))
+				continue;
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				events[2 * i] = { clippedBounds[i].min[axis], false };
+				events[2 * i + 1] = { clippedBounds[i].max[axis], true };
+			}
+
+			std::sort(events.begin(), events.end());
+
+			const int axis1 = (axis + 1) % 3;
+			const int axis2 = (axis + 2) % 3;
+			const float capArea = extent[axis1] * extent[axis2];
+			const float sideLength = extent[axis1] + extent[axis2];
+
+			uint32_t belowCount = 0;
+			uint32_t aboveCount = count;
+
+			for (const Event& event : events)
+			{
+				if (event.end)
+					aboveCount--;
+
+				const float position = event.position;
+				if (position > nodeBounds.min[axis] && position < nodeBounds.max[axis])
+				{
+					const float belowArea = 2.0f * (capArea + (position - nodeBounds.min[axis]) * sideLength);
+					const float aboveArea = 2.0f * (capArea + (nodeBounds.max[axis] - position) * sideLength);
+					const float bonus = (belowCount == 0 || aboveCount == 0) ? emptyBonus : 0.0f;
+
+					const float cost = settings.traversalCost + settings.intersectionCost * (1.0f - bonus) * invArea * (belowArea * belowCount + aboveArea * aboveCount);
+					if (cost < bestCost)
+					{
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = position;
+					}
+				}
+
+				if (!event.end)
+					belowCount++;
+			}
+		}
+	}
+
+public:
+	AABB						bounds;
+	std::vector<KdTreeNode>		nodes;		// nodes[0] is the root.
+	BVHPrimitives				primitives;
+};
+
+#endif // KD_TREE_H
@@ -0,0 +1,303 @@
+#ifndef LAZY_BVH_H
+#define LAZY_BVH_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "LinearBVH.h"
+
+// Node of the top levels of a LazyBVH. Leaves either hold primitives, like a LinearBVHNode, or stand for a subtree
+// that is built on first traversal.
+struct LazyBVHNode
+{
+	static const uint32_t s_LazyBVHSubtree = 0x80000000;
+
+	inline bool IsLeaf() const { return count > 0; }
+	inline bool IsSubtree() const { return (count & s_LazyBVHSubtree) != 0; }
+
+	AABB		aabb;
+	uint32_t	offset;	// Leaf: index of the first primitive. Subtree: index of the subtree. Interior: index of the left child, the right child follows it.
+	uint32_t	count;	// Leaf: primitive count. Subtree: s_LazyBVHSubtree. 0 for interior nodes.
+};
+
+// Subtree of a LazyBVH, built from the geometries [first, first + count) of BVHBuilder::primitiveIndices.
+struct LazyBVHSubtree
+{
+	std::once_flag		built;
+	std::atomic<bool>	isBuilt{ false };	// Set once bvh is complete, for readers outside of the call_once.
+	LinearBVH			bvh;
+	uint32_t			first = 0;
+	uint32_t			count = 0;
+};
+
+// BVH of which only the top levels are built up front, down to subtrees of at most BVHBuildSettings::lazySubtreeSize
+// primitives. A subtree is built the first time a ray enters its bounds, once even if several threads reach it at
+// the same time, and traversed as a nested LinearBVH. For very large scenes seen only in part, parts of the scene that
+// no ray reaches are never built, which shortens the time to the first pixel.
+// The top levels are always a binned SAH build, or median if requested. Subtrees use the build mode of the settings.
+class LazyBVH
+{
+public:
+	void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings)
+	{
+		Clear();
+
+		if (geometries.empty())
+			return;
+
+		sceneGeometries = &geometries;
+
+		subtreeSettings = settings;
+		subtreeSettings.lazySubtreeSize = 0;
+		subtreeSettings.taskScheduler = nullptr;	// Subtrees are built during traversal, possibly from inside a scheduler task.
+
+		BVHBuildSettings topSettings = settings;
+		if (topSettings.mode != BVHBuildMode::Median)
+			topSettings.mode = BVHBuildMode::SAH;
+
+		BVHBuilder builder(geometries, topSettings);
+		builder.lazySubtrees = true;
+		builder.Build();
+
+		primitiveIndices = builder.primitiveIndices;
+
+		uint32_t subtreeCount = 0;
+		for (const BVHBuildNode& buildNode : builder.nodes)
+		{
+			if (IsLazySubtree(buildNode))
+				subtreeCount++;
+		}
+
+		subtrees.reset(new LazyBVHSubtree[subtreeCount]);
+		this->subtreeCount = subtreeCount;
+
+		nodes.resize(builder.nodes.size());
+
+		uint32_t nodeCount = 1;
+		uint32_t subtreeIndex = 0;
+		std::vector<uint32_t> leafIndices;
+		Flatten(builder.nodes, 0, 0, nodeCount, subtreeIndex, leafIndices);
+
+		// Only the primitives of the top level leaves are resolved up front, subtrees resolve their own.
+		primitives.Build(geometries, leafIndices.data(), leafIndices.size());
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		primitives.Clear();
+		primitiveIndices.clear();
+		subtrees.reset();
+		subtreeCount = 0;
+		sceneGeometries = nullptr;
+	}
+
+	// Number of subtrees built so far, out of GetSubtreeCount.
+	uint32_t GetBuiltSubtreeCount() const
+	{
+		uint32_t builtCount = 0;
+		for (uint32_t i = 0; i < subtreeCount; i++)
+		{
+			if (subtrees[i].isBuilt.load(std::memory_order_acquire))
+				builtCount++;
+		}
+		return builtCount;
+	}
+
+	uint32_t GetSubtreeCount() const
+	{
+		return subtreeCount;
+	}
+
+	// Memory of the top levels and of the subtrees built so far. Subtrees being built are not counted yet.
+	size_t GetMemorySize() const
+	{
+		size_t size = nodes.size() * sizeof(LazyBVHNode) + primitiveIndices.size() * sizeof(uint32_t) + primitives.GetMemorySize();
+
+		for (uint32_t i = 0; i < subtreeCount; i++)
+		{
+			if (!subtrees[i].isBuilt.load(std::memory_order_acquire))
+				continue;
+
+			const LinearBVH& bvh = subtrees[i].bvh;
+			size += bvh.nodes.size() * sizeof(LinearBVHNode) + bvh.primitives.GetMemorySize();
+		}
+
+		return size;
+	}
+
+	// Same traversal as LinearBVH, subtrees are built when first entered and then searched for a hit closer than the
+	// closest one found so far, as part of this traversal.
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const LazyBVHNode* nodeData = nodes.data();
+
+		const TraversalRay ray(rayDesc.ray);
+
+		float tEntry;
+		if (!nodeData[0].aabb.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry))
+			return false;
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		bool hitFound = false;
+		PrimitiveHit closestHit;
+
+		struct StackEntry
+		{
+			uint32_t	nodeIndex;
+			float		tEntry;
+		};
+
+		StackEntry stack[s_BVHStackSize];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = 0;
+
+		while (true)
+		{
+			const LazyBVHNode& node = nodeData[nodeIndex];
+
+			if (node.IsSubtree())
+			{
+				const LinearBVH& subtree = GetSubtree(node.offset);
+				if (subtree.Hit(tempRayDesc, hitDesc, closestHit))
+					hitFound = true;
+			}
+			else if (node.IsLeaf())
+			{
+				if (primitives.Hit(node.offset, node.count, tempRayDesc, hitDesc, closestHit))
+					hitFound = true;
+			}
+			else
+			{
+				float tEntryLeft, tEntryRight;
+				bool hitLeft = nodeData[node.offset].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryLeft);
+				bool hitRight = nodeData[node.offset + 1].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryRight);
+
+				if (hitLeft && hitRight)
+				{
+					if (tEntryLeft <= tEntryRight)
+					{
+						stack[stackSize++] = { node.offset + 1, tEntryRight };
+						nodeIndex = node.offset;
+					}
+					else
+					{
+						stack[stackSize++] = { node.offset, tEntryLeft };
+						nodeIndex = node.offset + 1;
+					}
+					continue;
+				}
+				else if (hitLeft)
+				{
+					nodeIndex = node.offset;
+					continue;
+				}
+				else if (hitRight)
+				{
+					nodeIndex = node.offset + 1;
+					continue;
+				}
+			}
+
+			// Pop the next subtree that can still contain a closer hit.
+			do
+			{
+				if (stackSize == 0)
+				{
+					closestHit.Resolve(tempRayDesc, hitDesc);
+					return hitFound;
+				}
+
+				stackSize--;
+			}
+			while (stack[stackSize].tEntry > tempRayDesc.tmax);
+
+			nodeIndex = stack[stackSize].nodeIndex;
+		}
+	}
+
+private:
+	// The builder stops splitting at lazySubtreeSize primitives, leaves larger than any regular leaf are subtrees.
+	inline bool IsLazySubtree(const BVHBuildNode& buildNode) const
+	{
+		return buildNode.primitiveCount > s_BVHMaxLeafSize;
+	}
+
+	// Threads entering a subtree that is being built wait for it.
+	const LinearBVH& GetSubtree(uint32_t subtreeIndex) const
+	{
+		LazyBVHSubtree& subtree = subtrees[subtreeIndex];
+
+		std::call_once(subtree.built, [&]()
+		{
+			std::vector<shared_ptr<Geometry>> geometries(subtree.count);
+			for (uint32_t i = 0; i < subtree.count; i++)
+			{
+				geometries[i] = (*sceneGeometries)[primitiveIndices[subtree.first + i]];
+			}
+
+			subtree.bvh.Build(geometries, subtreeSettings);
+			subtree.isBuilt.store(true, std::memory_order_release);
+		});
+
+		return subtree.bvh;
+	}
+
+	void Flatten(const std::vector<BVHBuildNode>& buildNodes, uint32_t buildIndex, uint32_t index, uint32_t& nodeCount, uint32_t& subtreeIndex, std::vector<uint32_t>& leafIndices)
+	{
+		const BVHBuildNode& buildNode = buildNodes[buildIndex];
+
+		LazyBVHNode& node = nodes[index];
+		node.aabb = buildNode.aabb;
+
+		if (IsLazySubtree(buildNode))
+		{
+			LazyBVHSubtree& subtree = subtrees[subtreeIndex];
+			subtree.first = buildNode.offset;
+			subtree.count = buildNode.primitiveCount;
+
+			node.offset = subtreeIndex++;
+			node.count = LazyBVHNode::s_LazyBVHSubtree;
+			return;
+		}
+
+		if (buildNode.IsLeaf())
+		{
+			node.offset = static_cast<uint32_t>(leafIndices.size());
+			node.count = buildNode.primitiveCount;
+			leafIndices.insert(leafIndices.end(), primitiveIndices.begin() + buildNode.offset, primitiveIndices.begin() + buildNode.offset + buildNode.primitiveCount);
+			return;
+		}
+
+		// Allocate both children before descending so that siblings end up adjacent.
+		uint32_t childIndex = nodeCount;
+		nodeCount += 2;
+
+		node.offset = childIndex;
+		node.count = 0;
+
+		Flatten(buildNodes, buildNode.offset, childIndex, nodeCount, subtreeIndex, leafIndices);
+		Flatten(buildNodes, buildNode.offset + 1, childIndex + 1, nodeCount, subtreeIndex, leafIndices);
+	}
+
+public:
+	std::vector<LazyBVHNode>				nodes;				// nodes[0] is the root.
+	BVHPrimitives							primitives;			// Primitives of the top level leaves.
+
+private:
+	std::vector<uint32_t>					primitiveIndices;	// Build order of all geometries, subtrees reference ranges of it.
+	std::unique_ptr<LazyBVHSubtree[]>		subtrees;			// Mutable: built during the const traversal.
+	uint32_t								subtreeCount = 0;
+	BVHBuildSettings						subtreeSettings;
+	const std::vector<shared_ptr<Geometry>>*	sceneGeometries = nullptr;
+};
+
+#endif // LAZY_BVH_H
@@ -0,0 +1,370 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "BVH.h"
+#include "BVHArray.h"
+#include "BVHPrimitives.h"
+#include "BVHReorder.h"
+#include "Geometry.h"
+
+// Pointer-free BVH node. Nodes are stored depth-first in a single array and the two children of an interior node
+// are always stored next to each other, so both child boxes share a cache line during traversal.
+struct LinearBVHNode
+{
+	inline bool IsLeaf() const { return primitiveCount > 0; }
+
+	AABB		aabb;
+	uint32_t	offset;			// Leaf: index of the first primitive. Interior: index of the left child, the right child follows it.
+	uint16_t	primitiveCount;	// 0 for interior nodes.
+	uint16_t	pad;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode is expected to be 32 bytes.");
+
+class LinearBVH
+{
+public:
+	void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings)
+	{
+		Clear();
+
+		if (geometries.empty())
+			return;
+
+		BVHBuilder builder(geometries, settings);
+		builder.Build();
+
+		Build(builder);
+		ResolvePrimitives(geometries);
+
+		builtSAHCost = ComputeSAHCost(settings.traversalCost, settings.intersectionCost);
+	}
+
+	// Takes the nodes and the primitive order of a finished build, without resolving the primitives. BVHs over
+	// primitives that are not scene geometries, like the triangles of a TriangleMesh, traverse it with Traverse.
+	void Build(const BVHBuilder& builder)
+	{
+		// Leaves reference contiguous ranges of the builder's primitive order, so the same order is used here.
+		primitiveIndices = builder.primitiveIndices;
+
+		nodes.resize(builder.nodes.size());
+
+		uint32_t nodeCount = 1;
+		Flatten(builder.nodes, 0, 0, nodeCount);
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		primitiveIndices.clear();
+		primitives.Clear();
+		builtSAHCost = 0.0f;
+		visitCounts.reset();
+	}
+
+	// Starts counting how many times every node is visited by Hit, until the next Reorder.
+	void BeginProfiling()
+	{
+		visitCounts.reset(new std::atomic<uint32_t>[nodes.size()]);
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			visitCounts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Number of times Hit visited a node since BeginProfiling.
+	uint32_t GetVisitCount(uint32_t nodeIndex) const
+	{
+		return visitCounts ? visitCounts[nodeIndex].load(std::memory_order_relaxed) : 0;
+	}
+
+	// Stops counting node visits without reordering.
+	void EndProfiling()
+	{
+		visitCounts.reset();
+	}
+
+	// Changes the memory order of the nodes, keeping siblings adjacent and children after their parent.
+	// BVHNodeOrder::VisitCount uses the visit counts recorded since BeginProfiling, without them it is the same as
+	// BVHNodeOrder::VanEmdeBoas. Stops profiling.
+	void Reorder(BVHNodeOrder nodeOrder, float hotVisitFraction)
+	{
+		const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+
+		if (nodeCount > 1)
+		{
+			// Sibling pairs move as one unit. Unit 0 is the root and unit u > 0 the pair stored at nodes 2u - 1 and 2u.
+			const uint32_t unitCount = (nodeCount + 1) / 2;
+			const LinearBVHNode* nodeData = nodes.data();
+
+			std::vector<uint32_t> childStart(unitCount + 1);
+			std::vector<uint32_t> childUnits;
+			childUnits.reserve(unitCount - 1);
+
+			// A pair is loaded every time its parent is visited.
+			std::vector<uint64_t> unitVisitCounts(unitCount, 0);
+			if (visitCounts)
+				unitVisitCounts[0] = visitCounts[0].load(std::memory_order_relaxed);
+
+			for (uint32_t unit = 0; unit < unitCount; unit++)
+			{
+				childStart[unit] = static_cast<uint32_t>(childUnits.size());
+
+				const uint32_t first = (unit == 0) ? 0 : 2 * unit - 1;
+				const uint32_t last = (unit == 0) ? 0 : 2 * unit;
+
+				for (uint32_t index = first; index <= last; index++)
+				{
+					if (nodeData[index].IsLeaf())
+						continue;
+
+					const uint32_t childUnit = (nodeData[index].offset + 1) / 2;
+					childUnits.push_back(childUnit);
+
+					if (visitCounts)
+						unitVisitCounts[childUnit] = visitCounts[index].load(std::memory_order_relaxed);
+				}
+			}
+			childStart[unitCount] = static_cast<uint32_t>(childUnits.size());
+
+			BVHReorder reorder(childStart, childUnits);
+			const std::vector<uint32_t> order = reorder.Compute(nodeOrder, visitCounts ? &unitVisitCounts : nullptr, hotVisitFraction);
+
+			std::vector<uint32_t> newIndices(nodeCount);
+			newIndices[0] = 0;
+			for (uint32_t position = 1; position < unitCount; position++)
+			{
+				newIndices[2 * order[position] - 1] = 2 * position - 1;
+				newIndices[2 * order[position]] = 2 * position;
+			}
+
+			std::vector<LinearBVHNode> reordered(nodeCount);
+			for (uint32_t index = 0; index < nodeCount; index++)
+			{
+				LinearBVHNode node = nodeData[index];
+				if (!node.IsLeaf())
+					node.offset = newIndices[node.offset];
+
+				reordered[newIndices[index]] = node;
+			}
+
+			nodes = reordered;
+		}
+
+		visitCounts.reset();
+	}
+
+	// Points the leaf primitives at the geometries referenced by primitiveIndices.
+	void ResolvePrimitives(const std::vector<shared_ptr<Geometry>>& geometries)
+	{
+		primitives.Build(geometries, primitiveIndices.data(), primitiveIndices.size());
+	}
+
+	// Recomputes all node bounds bottom-up from the current primitive bounds, keeping the tree topology.
+	// Children are always stored after their parent, so a reverse sweep visits children first.
+	void Refit()
+	{
+		primitives.Refit();
+
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			LinearBVHNode& node = nodes[i];
+
+			if (node.IsLeaf())
+			{
+				node.aabb = AABB::Empty();
+				for (uint32_t p = node.offset; p < node.offset + node.primitiveCount; p++)
+				{
+					AABB aabb;
+					primitives[p]->GetBoundingBox(aabb);
+					node.aabb.Encapsulate(aabb);
+				}
+			}
+			else
+			{
+				node.aabb = nodes[node.offset].aabb;
+				node.aabb.Encapsulate(nodes[node.offset + 1].aabb);
+			}
+		}
+	}
+
+	// Expected cost of a random ray hitting the root, relative to the root surface area.
+	float ComputeSAHCost(float traversalCost, float intersectionCost) const
+	{
+		if (nodes.empty())
+			return 0.0f;
+
+		float cost = 0.0f;
+		for (const LinearBVHNode& node : nodes)
+		{
+			cost += node.aabb.SurfaceArea() * (node.IsLeaf() ? intersectionCost * node.primitiveCount : traversalCost);
+		}
+
+		return cost / nodes[0].aabb.SurfaceArea();
+	}
+
+	// Iterative traversal that tests both children of a node, descends into the nearer one first and
+	// skips subtrees whose entry distance is already beyond the closest hit found so far.
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		PrimitiveHit closestHit;
+		if (!Hit(tempRayDesc, hitDesc, closestHit))
+			return false;
+
+		closestHit.Resolve(tempRayDesc, hitDesc);
+		return true;
+	}
+
+	// Same as Hit for a traversal nested in another one, which keeps searching with the shortened rayDesc.tmax and
+	// resolves the closest hit once it is done.
+	bool Hit(RayDesc& rayDesc, HitDesc& hitDesc, PrimitiveHit& closestHit) const
+	{
+		auto leafHit = [&](uint32_t first, uint32_t count, RayDesc& leafRayDesc)
+		{
+			return primitives.Hit(first, count, leafRayDesc, hitDesc, closestHit);
+		};
+
+		return visitCounts ? TraverseNodes<true>(rayDesc, leafHit) : TraverseNodes<false>(rayDesc, leafHit);
+	}
+
+	// Same traversal with another leaf test: leafHit(first, count, rayDesc) tests the leaf primitives
+	// [first, first + count), shortens rayDesc.tmax to the closest hit among them and returns whether there is one.
+	template <typename LeafHit>
+	bool Traverse(RayDesc& rayDesc, const LeafHit& leafHit) const
+	{
+		return TraverseNodes<false>(rayDesc, leafHit);
+	}
+
+private:
+	template <bool CountVisits, typename LeafHit>
+	bool TraverseNodes(RayDesc& tempRayDesc, const LeafHit& leafHit) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const LinearBVHNode* nodeData = nodes.data();
+
+		const TraversalRay ray(tempRayDesc.ray);
+
+		float tEntry;
+		if (!nodeData[0].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntry))
+			return false;
+
+		bool hitFound = false;
+
+		struct StackEntry
+		{
+			uint32_t	nodeIndex;
+			float		tEntry;
+		};
+
+		StackEntry stack[s_BVHStackSize];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = 0;
+
+		while (true)
+		{
+			const LinearBVHNode& node = nodeData[nodeIndex];
+
+			if (CountVisits)
+				visitCounts[nodeIndex].fetch_add(1, std::memory_order_relaxed);
+
+			if (node.IsLeaf())
+			{
+				if (leafHit(node.offset, node.primitiveCount, tempRayDesc))
+					hitFound = true;
+			}
+			else
+			{
+				float tEntryLeft, tEntryRight;
+				bool hitLeft = nodeData[node.offset].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryLeft);
+				bool hitRight = nodeData[node.offset + 1].aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntryRight);
+
+				if (hitLeft && hitRight)
+				{
+					if (tEntryLeft <= tEntryRight)
+					{
+						stack[stackSize++] = { node.offset + 1, tEntryRight };
+						nodeIndex = node.offset;
+					}
+					else
+					{
+						stack[stackSize++] = { node.offset, tEntryLeft };
+						nodeIndex = node.offset + 1;
+					}
+					continue;
+				}
+				else if (hitLeft)
+				{
+					nodeIndex = node.offset;
+					continue;
+				}
+				else if (hitRight)
+				{
+					nodeIndex = node.offset + 1;
+					continue;
+				}
+			}
+
+			// Pop the next subtree that can still contain a closer hit.
+			do
+			{
+				if (stackSize == 0)
+					return hitFound;
+
+				stackSize--;
+			}
+			while (stack[stackSize].tEntry > tempRayDesc.tmax);
+
+			nodeIndex = stack[stackSize].nodeIndex;
+		}
+	}
+
+	// Subtrees are built concurrently so the builder's node order is arbitrary; store them depth-first.
+	void Flatten(const std::vector<BVHBuildNode>& buildNodes, uint32_t buildIndex, uint32_t index, uint32_t& nodeCount)
+	{
+		const BVHBuildNode& buildNode = buildNodes[buildIndex];
+
+		LinearBVHNode& node = nodes[index];
+		node.aabb = buildNode.aabb;
+		node.pad = 0;
+
+		if (buildNode.IsLeaf())
+		{
+			node.offset = buildNode.offset;
+			node.primitiveCount = static_cast<uint16_t>(buildNode.primitiveCount);
+			return;
+		}
+
+		// Allocate both children before descending so that siblings end up adjacent.
+		uint32_t childIndex = nodeCount;
+		nodeCount += 2;
+
+		node.offset = childIndex;
+		node.primitiveCount = 0;
+
+		Flatten(buildNodes, buildNode.offset, childIndex, nodeCount);
+		Flatten(buildNodes, buildNode.offset + 1, childIndex + 1, nodeCount);
+	}
+
+public:
+	BVHArray<LinearBVHNode>		nodes;
+	BVHArray<uint32_t>			primitiveIndices;	// Leaf primitives as indices into the scene geometries, or the primitives built over, in depth-first order.
+	BVHPrimitives				primitives;			// The same primitives resolved to geometries.
+
+	// SAH cost right after the build, the reference for how much refitting has degraded the tree.
+	float						builtSAHCost = 0.0f;
+
+private:
+	std::unique_ptr<std::atomic<uint32_t>[]>	visitCounts;	// Per node, while profiling.
+};
+
+#endif // LINEAR_BVH_H
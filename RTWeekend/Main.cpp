@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <atomic>
 
 #include "enkiTS/TaskScheduler.h"
@@ -6,11 +7,17 @@
 
 #include "RTWeekend.h"
 #include "Materials.h"
+#include "MeshLoader.h"
 #include "Camera.h"
+#include "Instance.h"
+#include "Plane.h"
 #include "Scene.h"
 #include "Sphere.h"
 #include "Texture.h"
 
+// Prints the acceleration structure stats before rendering, see ReportAccelerationStructureStats.
+#define REPORT_BVH_STATS 0
+
 Color3f* g_Output = nullptr;
 uint32_t g_OutputWidth = 400;
 uint32_t g_OutputHeight = 300;
@@ -18,6 +25,11 @@ uint32_t g_OutputHeight = 300;
 Camera g_Camera;
 Scene g_Scene;
 
+enkiTaskScheduler* g_TaskScheduler = nullptr;
+
+// Selected with the first command line argument, see ParseAccelerationStructureType.
+AccelerationStructureType g_AccelerationStructureType = AccelerationStructureType::BVH;
+
 thread_local uint64_t g_ThreadRayCount = 0;
 std::atomic_uint64_t g_TotalRayCount = 0;
 
@@ -124,14 +136,15 @@ static void DisplayProgressJob(uint32_t start, uint32_t end, uint32_t threadnum,
 	printf("\rPath tracing progress: 100%%");
 }
 
-// Scene 1: 3 Large Spheres + random smaller spheres using random materials.
+// Scene 1: Ground plane + 3 Large Spheres + random smaller spheres using random materials.
 void CreateScene1(Scene& scene)
 {
     shared_ptr<Texture> checkerOdd = make_shared<SolidColorTexture>(Color3f(0.2f, 0.3f, 0.1f));
     shared_ptr<Texture> checkerEven = make_shared<SolidColorTexture>(Color3f(0.9f, 0.9f, 0.9f));
 
     shared_ptr<LambertianWithCheckerTexture> groundMaterial = make_shared<LambertianWithCheckerTexture>(checkerOdd, checkerEven);
-    scene.Add(make_shared<Sphere>(groundMaterial, Vector3f(0, -1000, 0), 1000.0f));
+    // Just below y = 0, where the sines of the checker texture would all vanish.
+    scene.Add(make_shared<Plane>(groundMaterial, Vector3f(0, -0.001f, 0), Vector3f(0, 1, 0)));
 
     for (int a = -11; a < 11; a++)
     {
@@ -179,7 +192,86 @@ void CreateScene1(Scene& scene)
     shared_ptr<Metal> material3 = make_shared<Metal>(Color3f(0.7f, 0.6f, 0.5f), 0.0f);
     scene.Add(make_shared<Sphere>(material3, Vector3f(4, 1, 0), 1.0f));
 
-    scene.BuildAccelerationStructure();
+    BVHBuildSettings settings;
+    settings.taskScheduler = g_TaskScheduler;
+    settings.type = g_AccelerationStructureType;
+
+    scene.BuildAccelerationStructure(settings);
+}
+
+// Scene 2: Ground plane + instances of a single cluster of small spheres, placed with random rotations and scales.
+void CreateScene2(Scene& scene)
+{
+    shared_ptr<Texture> checkerOdd = make_shared<SolidColorTexture>(Color3f(0.2f, 0.3f, 0.1f));
+    shared_ptr<Texture> checkerEven = make_shared<SolidColorTexture>(Color3f(0.9f, 0.9f, 0.9f));
+
+    shared_ptr<LambertianWithCheckerTexture> groundMaterial = make_shared<LambertianWithCheckerTexture>(checkerOdd, checkerEven);
+    scene.Add(make_shared<Plane>(groundMaterial, Vector3f(0, -0.001f, 0), Vector3f(0, 1, 0)));
+
+    BVHBuildSettings settings;
+    settings.taskScheduler = g_TaskScheduler;
+    settings.type = g_AccelerationStructureType;
+
+    shared_ptr<BottomLevelAccelerationStructure> cluster = make_shared<BottomLevelAccelerationStructure>();
+
+    for (int i = 0; i < 16; i++)
+    {
+        Color3f albedo(RandomFloat01(), RandomFloat01(), RandomFloat01());
+        Vector3f center = 0.3f * RandomUnitVector() + Vector3f(0, 0.3f, 0);
+        cluster->Add(make_shared<Sphere>(make_shared<Lambertian>(albedo * albedo), center, 0.08f));
+    }
+
+    cluster->Build(settings);
+
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            float scale = RandomFloat(0.5f, 1.0f);
+            Matrix3x4 transform =
+                Matrix3x4::Translation(Vector3f(a + 0.9f * RandomFloat01(), 0.0f, b + 0.9f * RandomFloat01())) *
+                Matrix3x4::RotationY(RandomFloat(0.0f, 2.0f * pi)) *
+                Matrix3x4::Scale(Vector3f(scale, scale, scale));
+
+            scene.Add(make_shared<Instance>(cluster, transform, (a + 11) * 22 + (b + 11)));
+        }
+    }
+
+    scene.BuildAccelerationStructure(settings);
+}
+
+// Scene 3: Ground plane + the OBJ or PLY mesh at meshPath, scaled to stand 2 units tall at the origin.
+bool CreateScene3(Scene& scene, const char* meshPath)
+{
+    shared_ptr<Texture> checkerOdd = make_shared<SolidColorTexture>(Color3f(0.2f, 0.3f, 0.1f));
+    shared_ptr<Texture> checkerEven = make_shared<SolidColorTexture>(Color3f(0.9f, 0.9f, 0.9f));
+
+    shared_ptr<LambertianWithCheckerTexture> groundMaterial = make_shared<LambertianWithCheckerTexture>(checkerOdd, checkerEven);
+    scene.Add(make_shared<Plane>(groundMaterial, Vector3f(0, -0.001f, 0), Vector3f(0, 1, 0)));
+
+    BVHBuildSettings settings;
+    settings.taskScheduler = g_TaskScheduler;
+    settings.type = g_AccelerationStructureType;
+
+    // The mesh is placed with an instance, so it is loaded as is whatever its units.
+    shared_ptr<BottomLevelAccelerationStructure> model = make_shared<BottomLevelAccelerationStructure>();
+
+    if (!LoadMesh(model->scene, meshPath, make_shared<Lambertian>(Color3f(0.6f, 0.6f, 0.6f)), settings))
+        return false;
+
+    model->Build(settings);
+
+    const float scale = 2.0f / MaxComponent(model->aabb.Extent());
+    const Vector3f center = model->aabb.Center();
+    Matrix3x4 transform =
+        Matrix3x4::Translation(Vector3f(-center.x * scale, -model->aabb.min.y * scale, -center.z * scale)) *
+        Matrix3x4::Scale(Vector3f(scale, scale, scale));
+
+    scene.Add(make_shared<Instance>(model, transform));
+
+    scene.BuildAccelerationStructure(settings);
+
+    return true;
 }
 
 void CreateCamera(Camera& camera)
@@ -201,14 +293,39 @@ void CreateCamera(Camera& camera)
         distToFocus);
 }
 
+#if REPORT_BVH_STATS
+// Measures the traversal with one camera ray per pixel of a low resolution image.
+void ReportAccelerationStructureStats(Scene& scene, const Camera& camera)
+{
+    const uint32_t width = 160;
+    const uint32_t height = 120;
+
+    std::vector<RayDesc> rays;
+    rays.reserve(width * height);
+
+    for (uint32_t j = 0; j < height; j++)
+    {
+        for (uint32_t i = 0; i < width; i++)
+        {
+            RayDesc rayDesc;
+            rayDesc.ray = camera.GetRay((i + 0.5f) / width, (j + 0.5f) / height);
+            rayDesc.tmin = g_TMin;
+            rayDesc.tmax = g_TMax;
+            rays.push_back(rayDesc);
+        }
+    }
+
+    PrintBVHStats(scene.ComputeAccelerationStructureStats(&rays));
+}
+#endif
+
 void PathTraceScene()
 {
     DispatchRaysData dispatchRaysData;
     dispatchRaysData.imageWidth = g_OutputWidth;
     dispatchRaysData.imageHeight = g_OutputHeight;
 
-    enkiTaskScheduler* taskScheduler = enkiNewTaskScheduler();
-    enkiInitTaskScheduler(taskScheduler);
+    enkiTaskScheduler* taskScheduler = g_TaskScheduler;
 
     DisplayProgressJobData displayProgressJobData;
     displayProgressJobData.imageHeight = g_OutputHeight;
@@ -225,19 +342,75 @@ void PathTraceScene()
 
     enkiDeleteTaskSet(taskScheduler, taskDispatchRays);
     enkiDeleteTaskSet(taskScheduler, taskProgress);
+}
+
+struct AccelerationStructureName
+{
+	const char*					name;
+	AccelerationStructureType	type;
+};
 
-    enkiDeleteTaskScheduler(taskScheduler);
+const AccelerationStructureName g_AccelerationStructureNames[] =
+{
+	{ "bvh", AccelerationStructureType::BVH },
+	{ "bruteforce", AccelerationStructureType::BruteForce },
+	{ "grid", AccelerationStructureType::UniformGrid },
+	{ "kdtree", AccelerationStructureType::KdTree },
+	{ "dynamicbvh", AccelerationStructureType::DynamicBVH },
+};
+
+bool ParseAccelerationStructureType(const char* name, AccelerationStructureType& type)
+{
+	for (const AccelerationStructureName& entry : g_AccelerationStructureNames)
+	{
+		if (strcmp(name, entry.name) == 0)
+		{
+			type = entry.type;
+			return true;
+		}
+	}
+
+	return false;
 }
 
-int main()
+int main(int argc, char* argv[])
 {	
-	CreateScene1(g_Scene);
+	if (argc > 1 && !ParseAccelerationStructureType(argv[1], g_AccelerationStructureType))
+	{
+		printf("Usage: RTWeekend [bvh|bruteforce|grid|kdtree|dynamicbvh] [instances|mesh.obj|mesh.ply]\n");
+		return 1;
+	}
+
+	g_TaskScheduler = enkiNewTaskScheduler();
+	enkiInitTaskScheduler(g_TaskScheduler);
+
+	if (argc > 2 && strcmp(argv[2], "instances") == 0)
+	{
+		CreateScene2(g_Scene);
+	}
+	else if (argc > 2)
+	{
+		if (!CreateScene3(g_Scene, argv[2]))
+		{
+			printf("Failed to load %s.\n", argv[2]);
+			enkiDeleteTaskScheduler(g_TaskScheduler);
+			return 1;
+		}
+	}
+	else
+	{
+		CreateScene1(g_Scene);
+	}
 
 	CreateCamera(g_Camera);	
 
+#if REPORT_BVH_STATS
+	ReportAccelerationStructureStats(g_Scene, g_Camera);
+#endif
+
 	g_Output = new Vector3f[g_OutputWidth * g_OutputHeight];
 
-	printf("Generating output image.\n");
+	printf("Generating output image using the %s acceleration structure.\n", argc > 1 ? argv[1] : g_AccelerationStructureNames[0].name);
 
 	clock_t t0 = clock();
 
@@ -255,6 +428,8 @@ int main()
 
 	delete[] g_Output;
 
+	enkiDeleteTaskScheduler(g_TaskScheduler);
+
 	return 0;
 }
 
@@ -0,0 +1,115 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	bool Open(const char* path)
+	{
+		Close();
+
+#if defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping)
+		{
+			Close();
+			return false;
+		}
+
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		file = open(path, O_RDONLY);
+		if (file < 0)
+			return false;
+
+		struct stat fileStat;
+		if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+
+		size = static_cast<size_t>(fileStat.st_size);
+		data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data == MAP_FAILED)
+			data = nullptr;
+#endif
+
+		if (!data)
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#if defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap(data, size);
+		if (file >= 0)
+			close(file);
+
+		file = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+public:
+	void*	data = nullptr;
+	size_t	size = 0;
+
+private:
+#if defined(_WIN32)
+	HANDLE	file = INVALID_HANDLE_VALUE;
+	HANDLE	mapping = NULL;
+#else
+	int		file = -1;
+#endif
+};
+
+#endif // MAPPED_FILE_H
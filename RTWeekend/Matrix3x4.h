@@ -0,0 +1,146 @@
+#ifndef MATRIX3X4_H
+#define MATRIX3X4_H
+
+#include "AABB.h"
+#include "Vector3f.h"
+
+// Row-major affine transform, laid out like the Transform of D3D12_RAYTRACING_INSTANCE_DESC.
+// The last column is the translation.
+class Matrix3x4
+{
+public:
+	Matrix3x4()
+	{
+		*this = Identity();
+	}
+
+	Matrix3x4(
+		float m00, float m01, float m02, float m03,
+		float m10, float m11, float m12, float m13,
+		float m20, float m21, float m22, float m23)
+	{
+		m[0][0] = m00; m[0][1] = m01; m[0][2] = m02; m[0][3] = m03;
+		m[1][0] = m10; m[1][1] = m11; m[1][2] = m12; m[1][3] = m13;
+		m[2][0] = m20; m[2][1] = m21; m[2][2] = m22; m[2][3] = m23;
+	}
+
+	static Matrix3x4 Identity()
+	{
+		return Matrix3x4(
+			1, 0, 0, 0,
+			0, 1, 0, 0,
+			0, 0, 1, 0);
+	}
+
+	static Matrix3x4 Translation(const Vector3f& t)
+	{
+		return Matrix3x4(
+			1, 0, 0, t.x,
+			0, 1, 0, t.y,
+			0, 0, 1, t.z);
+	}
+
+	static Matrix3x4 Scale(const Vector3f& s)
+	{
+		return Matrix3x4(
+			s.x, 0, 0, 0,
+			0, s.y, 0, 0,
+			0, 0, s.z, 0);
+	}
+
+	static Matrix3x4 RotationY(float radians)
+	{
+		float c = cosf(radians);
+		float s = sinf(radians);
+		return Matrix3x4(
+			c, 0, s, 0,
+			0, 1, 0, 0,
+			-s, 0, c, 0);
+	}
+
+	Vector3f TransformPoint(const Vector3f& p) const
+	{
+		return Vector3f(
+			m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+			m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+			m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+	}
+
+	Vector3f TransformVector(const Vector3f& v) const
+	{
+		return Vector3f(
+			m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+			m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+			m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+	}
+
+	// Multiplies by the transpose of the 3x3 part. Called on the inverse transform, this maps normals to the other space.
+	Vector3f TransformNormalTransposed(const Vector3f& n) const
+	{
+		return Vector3f(
+			m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+			m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+			m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+	}
+
+	AABB TransformAABB(const AABB& aabb) const
+	{
+		// Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems 1990.
+		AABB result(Vector3f(m[0][3], m[1][3], m[2][3]), Vector3f(m[0][3], m[1][3], m[2][3]));
+
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				float a = m[i][j] * aabb.min[j];
+				float b = m[i][j] * aabb.max[j];
+				result.min[i] += FMIN(a, b);
+				result.max[i] += FMAX(a, b);
+			}
+		}
+
+		return result;
+	}
+
+	Matrix3x4 Inverse() const
+	{
+		// Inverse of the 3x3 part from its cofactors, then the translation is moved to the other side.
+		float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+
+		float invDet = 1.0f / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+		Matrix3x4 inv(
+			c00 * invDet, (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet, (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet, 0,
+			c01 * invDet, (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet, (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet, 0,
+			c02 * invDet, (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet, (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet, 0);
+
+		Vector3f t = -inv.TransformVector(Vector3f(m[0][3], m[1][3], m[2][3]));
+		inv.m[0][3] = t.x;
+		inv.m[1][3] = t.y;
+		inv.m[2][3] = t.z;
+
+		return inv;
+	}
+
+public:
+	float m[3][4];
+};
+
+inline Matrix3x4 operator*(const Matrix3x4& a, const Matrix3x4& b)
+{
+	Matrix3x4 r;
+
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + (j == 3 ? a.m[i][3] : 0.0f);
+		}
+	}
+
+	return r;
+}
+
+#endif // MATRIX3X4_H
@@ -0,0 +1,1199 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "enkiTS/TaskScheduler_c.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "TriangleMesh.h"
+
+// Triangle buffers of a loaded mesh, laid out as TriangleMesh expects them.
+struct MeshData
+{
+	std::vector<Vector3f>	positions;
+	std::vector<uint32_t>	indices;	// Three per triangle.
+	std::vector<Vector3f>	normals;	// Per position, empty if the file has none.
+	std::vector<float>		uvs;		// Two per position, empty if the file has none.
+};
+
+// Bytes of an OBJ file parsed by one task.
+const size_t s_MeshParseChunkSize = 4 << 20;
+
+// PLY vertices or faces read by one task.
+const uint32_t s_MeshParseBatchSize = 1 << 16;
+
+class MeshParser
+{
+protected:
+	// Runs job over [0, count) on the task scheduler, or on the calling thread without one.
+	static void RunJob(enkiTaskScheduler* taskScheduler, enkiTaskExecuteRange job, void* data, uint32_t count)
+	{
+		if (taskScheduler && count > 1)
+		{
+			enkiTaskSet* task = enkiCreateTaskSet(taskScheduler, job);
+			enkiAddTaskSetMinRange(taskScheduler, task, data, count, 1);
+			enkiWaitForTaskSet(taskScheduler, task);
+			enkiDeleteTaskSet(taskScheduler, task);
+		}
+		else if (count > 0)
+		{
+			job(0, count, 0, data);
+		}
+	}
+
+	static inline uint32_t BatchCount(size_t count, size_t batchSize)
+	{
+		return static_cast<uint32_t>((count + batchSize - 1) / batchSize);
+	}
+};
+
+// Wavefront OBJ: v, vt, vn and polygonal f lines, polygons are triangulated as fans. Other lines are skipped.
+// The file is split into chunks at line breaks that are parsed in two passes on the task scheduler. The first counts the
+// elements of every chunk, which gives each chunk its offsets in the output buffers, and the second parses into them,
+// so there is no allocation per element and no merge. Relative (negative) indices are resolved with the same offsets.
+// OBJ indexes positions, UVs and normals separately. When every corner uses the same index for all three, the buffers
+// are used as they are. Otherwise each corner gets a vertex of its own, as TriangleMesh has a single index per vertex.
+class ObjMeshParser : private MeshParser
+{
+public:
+	bool Parse(const char* data, size_t size, enkiTaskScheduler* taskScheduler, MeshData& mesh)
+	{
+		SplitChunks(data, size);
+
+		RunJob(taskScheduler, CountJob, this, static_cast<uint32_t>(chunks.size()));
+
+		size_t positionCount = 0, normalCount = 0, uvCount = 0, triangleCount = 0;
+		for (ObjChunk& chunk : chunks)
+		{
+			chunk.positionOffset = positionCount;
+			chunk.normalOffset = normalCount;
+			chunk.uvOffset = uvCount;
+			chunk.triangleOffset = triangleCount;
+
+			positionCount += chunk.positionCount;
+			normalCount += chunk.normalCount;
+			uvCount += chunk.uvCount;
+			triangleCount += chunk.triangleCount;
+		}
+
+		if (triangleCount == 0 || positionCount > UINT32_MAX || 3 * triangleCount > UINT32_MAX)
+			return false;
+
+		positions.resize(positionCount);
+		normals.resize(normalCount);
+		uvs.resize(2 * uvCount);
+		cornerPositions.resize(3 * triangleCount);
+		cornerNormals.resize(normalCount > 0 ? 3 * triangleCount : 0);
+		cornerUVs.resize(uvCount > 0 ? 3 * triangleCount : 0);
+
+		RunJob(taskScheduler, ParseJob, this, static_cast<uint32_t>(chunks.size()));
+
+		bool useNormals = normalCount > 0;
+		bool useUVs = uvCount > 0;
+		bool shared = true;
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (!chunk.valid)
+				return false;
+
+			useNormals &= !chunk.missingNormals;
+			useUVs &= !chunk.missingUVs;
+			shared &= chunk.sharedAttributes;
+		}
+
+		if (!useNormals)
+			cornerNormals = std::vector<uint32_t>();
+		if (!useUVs)
+			cornerUVs = std::vector<uint32_t>();
+
+		if (shared || (!useNormals && !useUVs))
+		{
+			// Unreferenced positions past the end of the normals or UVs get zeros, they are never interpolated.
+			mesh.positions = std::move(positions);
+			mesh.indices = std::move(cornerPositions);
+			if (useNormals)
+			{
+				normals.resize(mesh.positions.size());
+				mesh.normals = std::move(normals);
+			}
+			if (useUVs)
+			{
+				uvs.resize(2 * mesh.positions.size());
+				mesh.uvs = std::move(uvs);
+			}
+			return true;
+		}
+
+		output = &mesh;
+		mesh.positions.resize(cornerPositions.size());
+		mesh.indices.resize(cornerPositions.size());
+		mesh.normals.resize(useNormals ? cornerPositions.size() : 0);
+		mesh.uvs.resize(useUVs ? 2 * cornerPositions.size() : 0);
+
+		RunJob(taskScheduler, SplitVerticesJob, this, BatchCount(cornerPositions.size(), s_MeshParseBatchSize));
+
+		return true;
+	}
+
+private:
+	struct ObjChunk
+	{
+		const char*	begin;
+		const char*	end;
+
+		// Counted by the first pass.
+		uint32_t	positionCount = 0;
+		uint32_t	normalCount = 0;
+		uint32_t	uvCount = 0;
+		uint32_t	triangleCount = 0;
+
+		// Elements of the chunks before this one.
+		size_t		positionOffset = 0;
+		size_t		normalOffset = 0;
+		size_t		uvOffset = 0;
+		size_t		triangleOffset = 0;
+
+		// Found by the second pass.
+		bool		valid = true;
+		bool		missingNormals = false;		// A corner without a normal in a file with normals.
+		bool		missingUVs = false;
+		bool		sharedAttributes = true;	// Every corner uses its position index for its normal and UV.
+	};
+
+	enum class ObjLine
+	{
+		Position,
+		Normal,
+		UV,
+		Face,
+		Other,
+	};
+
+	static const uint32_t s_ObjNoIndex = UINT32_MAX;
+
+	// Chunks start at line starts. Every line then ends with a line break within the chunk it starts in, which lets the
+	// parser scan without bounds checks. A last line without one is copied into tail with one appended.
+	void SplitChunks(const char* data, size_t size)
+	{
+		size_t parsedSize = size;
+		while (parsedSize > 0 && data[parsedSize - 1] != '\n')
+			parsedSize--;
+
+		tail.assign(data + parsedSize, size - parsedSize);
+		tail.push_back('\n');
+
+		const uint32_t chunkCount = std::max<uint32_t>(BatchCount(parsedSize, s_MeshParseChunkSize), 1);
+
+		chunks.resize(chunkCount + 1);
+		for (uint32_t i = 0; i < chunkCount; i++)
+		{
+			size_t offset = parsedSize * i / chunkCount;
+			while (offset > 0 && offset < parsedSize && data[offset - 1] != '\n')
+				offset++;
+
+			chunks[i].begin = data + offset;
+		}
+		for (uint32_t i = 0; i < chunkCount; i++)
+		{
+			chunks[i].end = (i + 1 < chunkCount) ? chunks[i + 1].begin : data + parsedSize;
+		}
+
+		chunks[chunkCount].begin = tail.data();
+		chunks[chunkCount].end = tail.data() + tail.size();
+	}
+
+	static inline bool IsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+	static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+	static inline const char* SkipSpaces(const char* p)
+	{
+		while (IsSpace(*p))
+			p++;
+		return p;
+	}
+
+	static inline const char* SkipLine(const char* p)
+	{
+		while (*p != '\n')
+			p++;
+		return p + 1;
+	}
+
+	// Reads the keyword at the start of a line and moves past it.
+	static inline ObjLine ParseKeyword(const char*& p)
+	{
+		p = SkipSpaces(p);
+
+		if (p[0] == 'v')
+		{
+			if (IsSpace(p[1]))
+			{
+				p += 1;
+				return ObjLine::Position;
+			}
+			if (p[1] == 'n' && IsSpace(p[2]))
+			{
+				p += 2;
+				return ObjLine::Normal;
+			}
+			if (p[1] == 't' && IsSpace(p[2]))
+			{
+				p += 2;
+				return ObjLine::UV;
+			}
+		}
+		else if (p[0] == 'f' && IsSpace(p[1]))
+		{
+			p += 1;
+			return ObjLine::Face;
+		}
+
+		return ObjLine::Other;
+	}
+
+	static inline double Pow10(int exponent)
+	{
+		static const double s_Pow10[] =
+		{
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+		};
+
+		double scale = 1.0;
+		for (; exponent > 22; exponent -= 22)
+			scale *= 1e22;
+		return scale * s_Pow10[exponent];
+	}
+
+	// Decimal float without locale or strtof. Up to 19 significant digits are used, which is plenty for floats.
+	static inline const char* ParseFloat(const char* p, float& value, bool& valid)
+	{
+		p = SkipSpaces(p);
+
+		const bool negative = *p == '-';
+		if (*p == '-' || *p == '+')
+			p++;
+
+		const char* digitsStart = p;
+		uint64_t mantissa = 0;
+		int significantDigits = 0;
+		int exponent = 0;
+
+		for (; IsDigit(*p); p++)
+		{
+			if (significantDigits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significantDigits += (mantissa != 0) ? 1 : 0;
+			}
+			else
+			{
+				exponent++;
+			}
+		}
+
+		if (*p == '.')
+		{
+			for (p++; IsDigit(*p); p++)
+			{
+				if (significantDigits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					significantDigits += (mantissa != 0) ? 1 : 0;
+					exponent--;
+				}
+			}
+		}
+
+		if (p == digitsStart || (p == digitsStart + 1 && *digitsStart == '.'))
+		{
+			valid = false;
+			return p;
+		}
+
+		if (*p == 'e' || *p == 'E')
+		{
+			p++;
+			const bool negativeExponent = *p == '-';
+			if (*p == '-' || *p == '+')
+				p++;
+
+			int e = 0;
+			for (; IsDigit(*p); p++)
+				e = std::min<int>(e * 10 + (*p - '0'), 1000);
+
+			exponent += negativeExponent ? -e : e;
+		}
+
+		double result = static_cast<double>(mantissa);
+		if (exponent < 0)
+			result /= Pow10(std::min<int>(-exponent, 700));
+		else if (exponent > 0)
+			result *= Pow10(std::min<int>(exponent, 700));
+
+		value = static_cast<float>(negative ? -result : result);
+		return p;
+	}
+
+	// OBJ indices start at 1, negative ones count back from the last element defined before the line.
+	static inline const char* ParseIndex(const char* p, size_t definedCount, size_t totalCount, uint32_t& index, bool& valid)
+	{
+		const bool negative = *p == '-';
+		if (negative)
+			p++;
+
+		if (!IsDigit(*p))
+		{
+			valid = false;
+			return p;
+		}
+
+		int64_t value = 0;
+		for (; IsDigit(*p); p++)
+			value = std::min<int64_t>(value * 10 + (*p - '0'), INT64_C(1) << 40);
+
+		const int64_t resolved = negative ? static_cast<int64_t>(definedCount) - value : value - 1;
+		if (resolved < 0 || resolved >= static_cast<int64_t>(totalCount))
+		{
+			valid = false;
+			return p;
+		}
+
+		index = static_cast<uint32_t>(resolved);
+		return p;
+	}
+
+	static void CountJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		ObjMeshParser* parser = static_cast<ObjMeshParser*>(data);
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			ObjChunk& chunk = parser->chunks[i];
+
+			for (const char* p = chunk.begin; p < chunk.end; p = SkipLine(p))
+			{
+				switch (ParseKeyword(p))
+				{
+				case ObjLine::Position:
+					chunk.positionCount++;
+					break;
+				case ObjLine::Normal:
+					chunk.normalCount++;
+					break;
+				case ObjLine::UV:
+					chunk.uvCount++;
+					break;
+				case ObjLine::Face:
+				{
+					uint32_t cornerCount = 0;
+					for (p = SkipSpaces(p); *p != '\n' && *p != '#'; p = SkipSpaces(p))
+					{
+						cornerCount++;
+						while (!IsSpace(*p) && *p != '\n')
+							p++;
+					}
+					if (cornerCount >= 3)
+						chunk.triangleCount += cornerCount - 2;
+					break;
+				}
+				default:
+					break;
+				}
+			}
+		}
+	}
+
+	static void ParseJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		ObjMeshParser* parser = static_cast<ObjMeshParser*>(data);
+
+		for (uint32_t i = start; i < end; i++)
+		{
+			parser->ParseChunk(parser->chunks[i]);
+		}
+	}
+
+	void ParseChunk(ObjChunk& chunk)
+	{
+		size_t position = chunk.positionOffset;
+		size_t normal = chunk.normalOffset;
+		size_t uv = chunk.uvOffset;
+		size_t triangle = chunk.triangleOffset;
+
+		bool valid = true;
+
+		for (const char* p = chunk.begin; p < chunk.end && valid; p = SkipLine(p))
+		{
+			switch (ParseKeyword(p))
+			{
+			case ObjLine::Position:
+			{
+				Vector3f& v = positions[position++];
+				p = ParseFloat(p, v.x, valid);
+				p = ParseFloat(p, v.y, valid);
+				p = ParseFloat(p, v.z, valid);
+				break;
+			}
+			case ObjLine::Normal:
+			{
+				Vector3f& n = normals[normal++];
+				p = ParseFloat(p, n.x, valid);
+				p = ParseFloat(p, n.y, valid);
+				p = ParseFloat(p, n.z, valid);
+				break;
+			}
+			case ObjLine::UV:
+			{
+				float* t = &uvs[2 * uv++];
+				p = ParseFloat(p, t[0], valid);
+				t[1] = 0.0f;
+				p = SkipSpaces(p);
+				if (*p != '\n' && *p != '#')
+					p = ParseFloat(p, t[1], valid);
+				break;
+			}
+			case ObjLine::Face:
+			{
+				// Fan around the first corner.
+				uint32_t first[3];
+				uint32_t previous[3];
+				uint32_t cornerCount = 0;
+
+				for (p = SkipSpaces(p); *p != '\n' && *p != '#' && valid; p = SkipSpaces(p))
+				{
+					uint32_t corner[3] = { s_ObjNoIndex, s_ObjNoIndex, s_ObjNoIndex };
+					p = ParseCorner(p, position, uv, normal, corner, valid);
+
+					// Corners are separated as in CountJob, so that the triangles stay within the range of the chunk.
+					if (!IsSpace(*p) && *p != '\n' && *p != '#')
+						valid = false;
+
+					if (cornerCount >= 2)
+					{
+						if (triangle >= chunk.triangleOffset + chunk.triangleCount)
+						{
+							valid = false;
+							break;
+						}
+
+						WriteCorner(chunk, 3 * triangle, first);
+						WriteCorner(chunk, 3 * triangle + 1, previous);
+						WriteCorner(chunk, 3 * triangle + 2, corner);
+						triangle++;
+					}
+					else if (cornerCount == 0)
+					{
+						memcpy(first, corner, sizeof(corner));
+					}
+
+					memcpy(previous, corner, sizeof(corner));
+					cornerCount++;
+				}
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		chunk.valid = valid;
+	}
+
+	// position/uv/normal, position//normal, position/uv or position.
+	inline const char* ParseCorner(const char* p, size_t definedPositions, size_t definedUVs, size_t definedNormals, uint32_t corner[3], bool& valid) const
+	{
+		p = ParseIndex(p, definedPositions, positions.size(), corner[0], valid);
+		if (*p != '/')
+			return p;
+
+		p++;
+		if (*p != '/')
+			p = ParseIndex(p, definedUVs, uvs.size() / 2, corner[1], valid);
+
+		if (*p != '/')
+			return p;
+
+		p++;
+		return ParseIndex(p, definedNormals, normals.size(), corner[2], valid);
+	}
+
+	inline void WriteCorner(ObjChunk& chunk, size_t i, const uint32_t corner[3])
+	{
+		cornerPositions[i] = corner[0];
+
+		if (!cornerUVs.empty())
+		{
+			cornerUVs[i] = corner[1];
+			chunk.missingUVs |= corner[1] == s_ObjNoIndex;
+			chunk.sharedAttributes &= corner[1] == corner[0];
+		}
+
+		if (!cornerNormals.empty())
+		{
+			cornerNormals[i] = corner[2];
+			chunk.missingNormals |= corner[2] == s_ObjNoIndex;
+			chunk.sharedAttributes &= corner[2] == corner[0];
+		}
+	}
+
+	static void SplitVerticesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		ObjMeshParser* parser = static_cast<ObjMeshParser*>(data);
+		MeshData& mesh = *parser->output;
+
+		const size_t first = static_cast<size_t>(start) * s_MeshParseBatchSize;
+		const size_t last = std::min<size_t>(static_cast<size_t>(end) * s_MeshParseBatchSize, parser->cornerPositions.size());
+
+		for (size_t i = first; i < last; i++)
+		{
+			mesh.positions[i] = parser->positions[parser->cornerPositions[i]];
+			mesh.indices[i] = static_cast<uint32_t>(i);
+
+			if (!mesh.normals.empty())
+				mesh.normals[i] = parser->normals[parser->cornerNormals[i]];
+
+			if (!mesh.uvs.empty())
+			{
+				mesh.uvs[2 * i] = parser->uvs[2 * parser->cornerUVs[i]];
+				mesh.uvs[2 * i + 1] = parser->uvs[2 * parser->cornerUVs[i] + 1];
+			}
+		}
+	}
+
+	std::vector<ObjChunk>	chunks;
+	std::string				tail;
+
+	std::vector<Vector3f>	positions;
+	std::vector<Vector3f>	normals;
+	std::vector<float>		uvs;
+	std::vector<uint32_t>	cornerPositions;	// Three corners per triangle.
+	std::vector<uint32_t>	cornerNormals;
+	std::vector<uint32_t>	cornerUVs;
+
+	MeshData*				output = nullptr;
+};
+
+// Binary little endian PLY with a vertex element (x, y, z and optionally nx, ny, nz and u, v / s, t / texture_u,
+// texture_v) and a face element with a vertex_indices list, polygons are triangulated as fans. Other elements are skipped.
+// Vertices are fixed size records and are read in parallel batches. Faces are read in parallel too when they are all
+// triangles: the records are then fixed size as well, which holds if the count of every record at its assumed offset
+// is 3. Meshes with other polygons are read sequentially.
+class PlyMeshParser : private MeshParser
+{
+public:
+	bool Parse(const char* data, size_t size, enkiTaskScheduler* taskScheduler, MeshData& mesh)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		const uint8_t* end = bytes + size;
+
+		size_t offset;
+		if (!ParseHeader(data, size, offset))
+			return false;
+
+		const PlyElement* vertexElement = nullptr;
+		const PlyElement* faceElement = nullptr;
+
+		// Elements follow each other in header order.
+		for (PlyElement& element : elements)
+		{
+			element.data = bytes + offset;
+
+			if (element.name == "vertex")
+				vertexElement = &element;
+			else if (element.name == "face")
+				faceElement = &element;
+
+			if (element.name == "face" || element.recordSize == 0)
+			{
+				// Variable size records, walked to find where the next element starts.
+				if (&element != &elements.back() && !SkipRecords(element, end, offset))
+					return false;
+			}
+			else
+			{
+				offset += element.count * element.recordSize;
+			}
+
+			if (offset > size)
+				return false;
+		}
+
+		if (!vertexElement || !faceElement || vertexElement->recordSize == 0)
+			return false;
+
+		const PlyProperty* x = FindProperty(*vertexElement, "x");
+		const PlyProperty* y = FindProperty(*vertexElement, "y");
+		const PlyProperty* z = FindProperty(*vertexElement, "z");
+		if (!x || !y || !z)
+			return false;
+
+		vertex = vertexElement;
+		positionProperties[0] = x;
+		positionProperties[1] = y;
+		positionProperties[2] = z;
+		normalProperties[0] = FindProperty(*vertexElement, "nx");
+		normalProperties[1] = FindProperty(*vertexElement, "ny");
+		normalProperties[2] = FindProperty(*vertexElement, "nz");
+		uvProperties[0] = FindProperty(*vertexElement, "u", "s", "texture_u");
+		uvProperties[1] = FindProperty(*vertexElement, "v", "t", "texture_v");
+
+		if (vertexElement->count > UINT32_MAX)
+			return false;
+
+		output = &mesh;
+		mesh.positions.resize(vertexElement->count);
+		mesh.normals.resize((normalProperties[0] && normalProperties[1] && normalProperties[2]) ? vertexElement->count : 0);
+		mesh.uvs.resize((uvProperties[0] && uvProperties[1]) ? 2 * vertexElement->count : 0);
+
+		RunJob(taskScheduler, VerticesJob, this, BatchCount(vertexElement->count, s_MeshParseBatchSize));
+
+		face = faceElement;
+		indexProperty = FindProperty(*faceElement, "vertex_indices", "vertex_index");
+		if (!indexProperty || !indexProperty->isList)
+			return false;
+
+		// Triangle records, if every face is a triangle.
+		triangleRecordSize = 0;
+		for (const PlyProperty& property : faceElement->properties)
+		{
+			if (property.isList && &property != indexProperty)
+			{
+				triangleRecordSize = 0;
+				break;
+			}
+
+			triangleRecordSize += (&property == indexProperty) ? property.countSize + 3 * property.size : property.size;
+		}
+
+		bool triangles = triangleRecordSize > 0 && faceElement->count * triangleRecordSize <= static_cast<size_t>(end - faceElement->data) &&
+			3 * faceElement->count <= UINT32_MAX;
+
+		if (triangles)
+		{
+			const uint32_t batchCount = BatchCount(faceElement->count, s_MeshParseBatchSize);
+			batchValid.assign(batchCount, 1);
+			mesh.indices.resize(3 * faceElement->count);
+
+			RunJob(taskScheduler, TrianglesJob, this, batchCount);
+
+			if (!polygons.load())
+			{
+				for (uint8_t valid : batchValid)
+				{
+					if (!valid)
+						return false;
+				}
+				return true;
+			}
+		}
+
+		return ParsePolygons(end, mesh);
+	}
+
+private:
+	enum class PlyType
+	{
+		Int8,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Float32,
+		Float64,
+	};
+
+	struct PlyProperty
+	{
+		std::string	name;
+		PlyType		type;
+		uint32_t	size;			// Bytes of the value, of each list entry for lists.
+		uint32_t	offset;			// In the record, fixed size records only.
+		bool		isList;
+		PlyType		countType;
+		uint32_t	countSize;
+	};
+
+	struct PlyElement
+	{
+		std::string					name;
+		size_t						count;
+		std::vector<PlyProperty>	properties;
+		uint32_t					recordSize;	// 0 if the element has a list property.
+		const uint8_t*				data;
+	};
+
+	static bool ParseType(const std::string& name, PlyType& type, uint32_t& size)
+	{
+		struct PlyTypeName
+		{
+			const char*	name;
+			PlyType		type;
+			uint32_t	size;
+		};
+
+		static const PlyTypeName s_PlyTypeNames[] =
+		{
+			{ "char", PlyType::Int8, 1 }, { "int8", PlyType::Int8, 1 },
+			{ "uchar", PlyType::UInt8, 1 }, { "uint8", PlyType::UInt8, 1 },
+			{ "short", PlyType::Int16, 2 }, { "int16", PlyType::Int16, 2 },
+			{ "ushort", PlyType::UInt16, 2 }, { "uint16", PlyType::UInt16, 2 },
+			{ "int", PlyType::Int32, 4 }, { "int32", PlyType::Int32, 4 },
+			{ "uint", PlyType::UInt32, 4 }, { "uint32", PlyType::UInt32, 4 },
+			{ "float", PlyType::Float32, 4 }, { "float32", PlyType::Float32, 4 },
+			{ "double", PlyType::Float64, 8 }, { "float64", PlyType::Float64, 8 },
+		};
+
+		for (const PlyTypeName& entry : s_PlyTypeNames)
+		{
+			if (name == entry.name)
+			{
+				type = entry.type;
+				size = entry.size;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Header lines up to end_header, words separated by spaces. Sets offset to the first byte of element data.
+	bool ParseHeader(const char* data, size_t size, size_t& offset)
+	{
+		elements.clear();
+
+		bool binaryLittleEndian = false;
+		size_t lineStart = 0;
+		bool firstLine = true;
+
+		while (lineStart < size)
+		{
+			const char* lineEnd = static_cast<const char*>(memchr(data + lineStart, '\n', size - lineStart));
+			if (!lineEnd)
+				return false;
+
+			std::vector<std::string> words;
+			for (const char* p = data + lineStart; p < lineEnd;)
+			{
+				while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r'))
+					p++;
+				const char* wordStart = p;
+				while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r')
+					p++;
+				if (p > wordStart)
+					words.emplace_back(wordStart, p);
+			}
+
+			lineStart = lineEnd - data + 1;
+
+			if (firstLine)
+			{
+				if (words.size() != 1 || words[0] != "ply")
+					return false;
+				firstLine = false;
+				continue;
+			}
+
+			if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+				continue;
+
+			if (words[0] == "format")
+			{
+				binaryLittleEndian = words.size() >= 2 && words[1] == "binary_little_endian";
+			}
+			else if (words[0] == "element" && words.size() == 3)
+			{
+				PlyElement element;
+				element.name = words[1];
+				element.count = static_cast<size_t>(strtoull(words[2].c_str(), nullptr, 10));
+				element.recordSize = 0;
+				element.data = nullptr;
+				elements.push_back(element);
+			}
+			else if (words[0] == "property" && !elements.empty())
+			{
+				PlyProperty property;
+				property.isList = words.size() == 5 && words[1] == "list";
+				property.countType = PlyType::UInt8;
+				property.countSize = 0;
+
+				if (property.isList)
+				{
+					if (!ParseType(words[2], property.countType, property.countSize) || !ParseType(words[3], property.type, property.size))
+						return false;
+					property.name = words[4];
+				}
+				else
+				{
+					if (words.size() != 3 || !ParseType(words[1], property.type, property.size))
+						return false;
+					property.name = words[2];
+				}
+
+				elements.back().properties.push_back(property);
+			}
+			else if (words[0] == "end_header")
+			{
+				offset = lineStart;
+				break;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		if (!binaryLittleEndian || elements.empty())
+			return false;
+
+		for (PlyElement& element : elements)
+		{
+			uint32_t recordSize = 0;
+			for (PlyProperty& property : element.properties)
+			{
+				property.offset = recordSize;
+				if (property.isList)
+				{
+					recordSize = 0;
+					break;
+				}
+				recordSize += property.size;
+			}
+			element.recordSize = recordSize;
+		}
+
+		return true;
+	}
+
+	static const PlyProperty* FindProperty(const PlyElement& element, const char* name, const char* alias0 = nullptr, const char* alias1 = nullptr)
+	{
+		for (const PlyProperty& property : element.properties)
+		{
+			if (property.name == name || (alias0 && property.name == alias0) || (alias1 && property.name == alias1))
+				return &property;
+		}
+		return nullptr;
+	}
+
+	static inline double ReadValue(const uint8_t* p, PlyType type)
+	{
+		switch (type)
+		{
+		case PlyType::Int8:		{ int8_t v; memcpy(&v, p, sizeof(v)); return v; }
+		case PlyType::UInt8:	return *p;
+		case PlyType::Int16:	{ int16_t v; memcpy(&v, p, sizeof(v)); return v; }
+		case PlyType::UInt16:	{ uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+		case PlyType::Int32:	{ int32_t v; memcpy(&v, p, sizeof(v)); return v; }
+		case PlyType::UInt32:	{ uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+		case PlyType::Float32:	{ float v; memcpy(&v, p, sizeof(v)); return v; }
+		default:				{ double v; memcpy(&v, p, sizeof(v)); return v; }
+		}
+	}
+
+	static inline float ReadFloat(const uint8_t* record, const PlyProperty& property)
+	{
+		if (property.type == PlyType::Float32)
+		{
+			float v;
+			memcpy(&v, record + property.offset, sizeof(v));
+			return v;
+		}
+		return static_cast<float>(ReadValue(record + property.offset, property.type));
+	}
+
+	// List counts of signed types can be negative, no record holds such a list.
+	static inline bool ReadCount(const uint8_t* p, PlyType type, size_t& count)
+	{
+		const double value = ReadValue(p, type);
+		if (!(value >= 0.0 && value <= static_cast<double>(UINT32_MAX)))
+			return false;
+
+		count = static_cast<size_t>(value);
+		return true;
+	}
+
+	// Indices outside the vertices make the index invalid.
+	inline bool ReadIndex(const uint8_t* p, uint32_t& index) const
+	{
+		const double value = ReadValue(p, indexProperty->type);
+		if (!(value >= 0.0 && value < static_cast<double>(vertex->count)))
+			return false;
+
+		index = static_cast<uint32_t>(value);
+		return true;
+	}
+
+	// Size of a record with list properties.
+	static inline bool RecordSize(const PlyElement& element, const uint8_t* record, const uint8_t* end, size_t& size)
+	{
+		const size_t available = static_cast<size_t>(end - record);
+
+		size = 0;
+		for (const PlyProperty& property : element.properties)
+		{
+			if (property.isList)
+			{
+				if (size + property.countSize > available)
+					return false;
+
+				size_t count;
+				if (!ReadCount(record + size, property.countType, count))
+					return false;
+
+				size += property.countSize;
+				if (count > (available - size) / property.size)
+					return false;
+
+				size += count * property.size;
+			}
+			else
+			{
+				size += property.size;
+			}
+		}
+		return size <= available;
+	}
+
+	// Moves offset, from the start of the file, past the records of an element with list properties.
+	static bool SkipRecords(const PlyElement& element, const uint8_t* end, size_t& offset)
+	{
+		const uint8_t* record = element.data;
+		for (size_t i = 0; i < element.count; i++)
+		{
+			size_t size;
+			if (!RecordSize(element, record, end, size))
+				return false;
+			record += size;
+		}
+
+		offset += static_cast<size_t>(record - element.data);
+		return true;
+	}
+
+	static void VerticesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		PlyMeshParser* parser = static_cast<PlyMeshParser*>(data);
+		MeshData& mesh = *parser->output;
+		const PlyElement& vertex = *parser->vertex;
+
+		const size_t first = static_cast<size_t>(start) * s_MeshParseBatchSize;
+		const size_t last = std::min<size_t>(static_cast<size_t>(end) * s_MeshParseBatchSize, vertex.count);
+
+		for (size_t i = first; i < last; i++)
+		{
+			const uint8_t* record = vertex.data + i * vertex.recordSize;
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				mesh.positions[i][axis] = ReadFloat(record, *parser->positionProperties[axis]);
+			}
+
+			if (!mesh.normals.empty())
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					mesh.normals[i][axis] = ReadFloat(record, *parser->normalProperties[axis]);
+				}
+			}
+
+			if (!mesh.uvs.empty())
+			{
+				mesh.uvs[2 * i] = ReadFloat(record, *parser->uvProperties[0]);
+				mesh.uvs[2 * i + 1] = ReadFloat(record, *parser->uvProperties[1]);
+			}
+		}
+	}
+
+	// Reads faces as triangle records. A count other than 3 means the records are not where they were assumed to be,
+	// the faces are then read again by ParsePolygons.
+	static void TrianglesJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		PlyMeshParser* parser = static_cast<PlyMeshParser*>(data);
+		MeshData& mesh = *parser->output;
+		const PlyElement& face = *parser->face;
+		const PlyProperty& indexProperty = *parser->indexProperty;
+
+		uint32_t indexOffset = 0;
+		for (const PlyProperty& property : face.properties)
+		{
+			if (&property == &indexProperty)
+				break;
+			indexOffset += property.size;
+		}
+
+		for (uint32_t batch = start; batch < end; batch++)
+		{
+			const size_t first = static_cast<size_t>(batch) * s_MeshParseBatchSize;
+			const size_t last = std::min<size_t>(first + s_MeshParseBatchSize, face.count);
+
+			for (size_t i = first; i < last; i++)
+			{
+				const uint8_t* list = face.data + i * parser->triangleRecordSize + indexOffset;
+
+				if (ReadValue(list, indexProperty.countType) != 3.0)
+				{
+					parser->polygons.store(true);
+					break;
+				}
+
+				for (int corner = 0; corner < 3; corner++)
+				{
+					if (!parser->ReadIndex(list + indexProperty.countSize + corner * indexProperty.size, mesh.indices[3 * i + corner]))
+					{
+						parser->batchValid[batch] = 0;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	bool ParsePolygons(const uint8_t* end, MeshData& mesh)
+	{
+		// Triangle count first, so that the indices are allocated once.
+		size_t triangleCount = 0;
+		const uint8_t* record = face->data;
+		for (size_t i = 0; i < face->count; i++)
+		{
+			size_t size;
+			if (!RecordSize(*face, record, end, size))
+				return false;
+
+			const size_t cornerCount = ListCount(record);
+			triangleCount += (cornerCount >= 3) ? cornerCount - 2 : 0;
+			record += size;
+		}
+
+		if (3 * triangleCount > UINT32_MAX)
+			return false;
+
+		mesh.indices.resize(3 * triangleCount);
+
+		size_t triangle = 0;
+		record = face->data;
+		for (size_t i = 0; i < face->count; i++)
+		{
+			size_t size;
+			RecordSize(*face, record, end, size);
+
+			const uint8_t* list = record + ListOffset(record);
+			const size_t cornerCount = ListCount(record);
+
+			uint32_t first = 0;
+			uint32_t previous = 0;
+			for (size_t corner = 0; corner < cornerCount; corner++)
+			{
+				uint32_t index;
+				if (!ReadIndex(list + indexProperty->countSize + corner * indexProperty->size, index))
+					return false;
+
+				if (corner >= 2)
+				{
+					mesh.indices[3 * triangle] = first;
+					mesh.indices[3 * triangle + 1] = previous;
+					mesh.indices[3 * triangle + 2] = index;
+					triangle++;
+				}
+				else if (corner == 0)
+				{
+					first = index;
+				}
+				previous = index;
+			}
+
+			record += size;
+		}
+
+		return triangleCount > 0;
+	}
+
+	// Offset of the index list in a face record, the lists before it have variable sizes. The record must have been
+	// checked with RecordSize, so that its counts are valid.
+	inline size_t ListOffset(const uint8_t* record) const
+	{
+		size_t offset = 0;
+		for (const PlyProperty& property : face->properties)
+		{
+			if (&property == indexProperty)
+				break;
+
+			size_t count = 0;
+			if (property.isList)
+				ReadCount(record + offset, property.countType, count);
+
+			offset += property.isList ? property.countSize + count * property.size : property.size;
+		}
+		return offset;
+	}
+
+	inline size_t ListCount(const uint8_t* record) const
+	{
+		size_t count = 0;
+		ReadCount(record + ListOffset(record), indexProperty->countType, count);
+		return count;
+	}
+
+	std::vector<PlyElement>	elements;
+
+	const PlyElement*		vertex = nullptr;
+	const PlyProperty*		positionProperties[3] = {};
+	const PlyProperty*		normalProperties[3] = {};
+	const PlyProperty*		uvProperties[2] = {};
+
+	const PlyElement*		face = nullptr;
+	const PlyProperty*		indexProperty = nullptr;
+	size_t					triangleRecordSize = 0;
+	std::vector<uint8_t>	batchValid;
+	std::atomic<bool>		polygons{ false };	// Set by TrianglesJob when a face is not a triangle.
+
+	MeshData*				output = nullptr;
+};
+
+// Maps the OBJ or binary PLY file at path, told apart by the PLY magic, and parses it into mesh on the task scheduler.
+// Returns false if the file cannot be read, is malformed or has no triangles.
+inline bool LoadMeshData(const char* path, enkiTaskScheduler* taskScheduler, MeshData& mesh)
+{
+	mesh = MeshData();
+
+	MappedFile file;
+	if (!file.Open(path))
+		return false;
+
+	const char* data = static_cast<const char*>(file.data);
+
+	bool loaded;
+	if (file.size >= 4 && memcmp(data, "ply", 3) == 0 && (data[3] == '\n' || data[3] == '\r'))
+		loaded = PlyMeshParser().Parse(data, file.size, taskScheduler, mesh);
+	else
+		loaded = ObjMeshParser().Parse(data, file.size, taskScheduler, mesh);
+
+	if (!loaded)
+		mesh = MeshData();
+
+	return loaded;
+}
+
+// Loads the mesh at path and adds it to the scene as a single TriangleMesh. settings.taskScheduler parses the file, and
+// the mesh BVH is built with settings. The scene acceleration structure still has to be built. Returns null on failure.
+inline shared_ptr<TriangleMesh> LoadMesh(Scene& scene, const char* path, shared_ptr<Material> material, const BVHBuildSettings& settings = BVHBuildSettings())
+{
+	MeshData data;
+	if (!LoadMeshData(path, settings.taskScheduler, data))
+		return nullptr;
+
+	shared_ptr<TriangleMesh> mesh = make_shared<TriangleMesh>(material, std::move(data.positions), std::move(data.indices),
+		std::move(data.normals), std::move(data.uvs), settings);
+
+	scene.Add(mesh);
+	return mesh;
+}
+
+#endif // MESH_LOADER_H
@@ -0,0 +1,201 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "enkiTS/TaskScheduler_c.h"
+
+// Spreads the lower 10 bits of x so that there are two zero bits between each of them.
+inline uint32_t ExpandBits10(uint32_t x)
+{
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+// Spreads the lower 21 bits of x so that there are two zero bits between each of them.
+inline uint64_t ExpandBits21(uint64_t x)
+{
+	x &= 0x1FFFFF;
+	x = (x | (x << 32)) & 0x001F00000000FFFFull;
+	x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+	x = (x | (x << 8)) & 0x100F00F00F00F00Full;
+	x = (x | (x << 4)) & 0x10C30C30C30C30C3ull;
+	x = (x | (x << 2)) & 0x1249249249249249ull;
+	return x;
+}
+
+// p is expected in [0, 1]^3.
+inline uint64_t MortonCode30(const Vector3f& p)
+{
+	uint32_t x = static_cast<uint32_t>(Clamp(p.x * 1024.0f, 0.0f, 1023.0f));
+	uint32_t y = static_cast<uint32_t>(Clamp(p.y * 1024.0f, 0.0f, 1023.0f));
+	uint32_t z = static_cast<uint32_t>(Clamp(p.z * 1024.0f, 0.0f, 1023.0f));
+	return (ExpandBits10(x) << 2) | (ExpandBits10(y) << 1) | ExpandBits10(z);
+}
+
+// p is expected in [0, 1]^3.
+inline uint64_t MortonCode63(const Vector3f& p)
+{
+	const float scale = static_cast<float>(1 << 21);
+	uint64_t x = static_cast<uint64_t>(Clamp(p.x * scale, 0.0f, scale - 1.0f));
+	uint64_t y = static_cast<uint64_t>(Clamp(p.y * scale, 0.0f, scale - 1.0f));
+	uint64_t z = static_cast<uint64_t>(Clamp(p.z * scale, 0.0f, scale - 1.0f));
+	return (ExpandBits21(x) << 2) | (ExpandBits21(y) << 1) | ExpandBits21(z);
+}
+
+inline int CountLeadingZeros64(uint64_t x)
+{
+	if (x == 0)
+		return 64;
+
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return 63 - static_cast<int>(index);
+#elif defined(_MSC_VER)
+	unsigned long index;
+	if (_BitScanReverse(&index, static_cast<uint32_t>(x >> 32)))
+		return 31 - static_cast<int>(index);
+	_BitScanReverse(&index, static_cast<uint32_t>(x));
+	return 63 - static_cast<int>(index);
+#else
+	return __builtin_clzll(x);
+#endif
+}
+
+// Least significant digit radix sort of (key, value) pairs, 8 bits per pass. Keys only need to be sorted up to keyBits.
+// The input is split in chunks that compute their digit histograms and scatter their elements in parallel.
+class RadixSort
+{
+public:
+	static void Sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, uint32_t keyBits, enkiTaskScheduler* taskScheduler)
+	{
+		const uint32_t count = static_cast<uint32_t>(keys.size());
+
+		RadixSort sort;
+		sort.keys[0] = &keys;
+		sort.values[0] = &values;
+		sort.keys[1] = &sort.tempKeys;
+		sort.values[1] = &sort.tempValues;
+		sort.tempKeys.resize(count);
+		sort.tempValues.resize(count);
+
+		sort.chunkCount = taskScheduler ? enkiGetNumTaskThreads(taskScheduler) : 1;
+		sort.chunkSize = (count + sort.chunkCount - 1) / sort.chunkCount;
+		sort.histograms.resize(sort.chunkCount * s_DigitCount);
+
+		const uint32_t passCount = (keyBits + s_DigitBits - 1) / s_DigitBits;
+
+		for (uint32_t pass = 0; pass < passCount; pass++)
+		{
+			sort.source = pass & 1;
+			sort.shift = pass * s_DigitBits;
+
+			sort.Run(taskScheduler, HistogramJob);
+
+			// Exclusive prefix sum over (digit, chunk) gives each chunk its first output slot per digit.
+			uint32_t offset = 0;
+			for (uint32_t digit = 0; digit < s_DigitCount; digit++)
+			{
+				for (uint32_t chunk = 0; chunk < sort.chunkCount; chunk++)
+				{
+					uint32_t& bucket = sort.histograms[chunk * s_DigitCount + digit];
+					uint32_t bucketCount = bucket;
+					bucket = offset;
+					offset += bucketCount;
+				}
+			}
+
+			sort.Run(taskScheduler, ScatterJob);
+		}
+
+		if (passCount & 1)
+		{
+			keys.swap(sort.tempKeys);
+			values.swap(sort.tempValues);
+		}
+	}
+
+private:
+	static const uint32_t s_DigitBits = 8;
+	static const uint32_t s_DigitCount = 1 << s_DigitBits;
+
+	void Run(enkiTaskScheduler* taskScheduler, enkiTaskExecuteRange job)
+	{
+		if (taskScheduler && chunkCount > 1)
+		{
+			enkiTaskSet* task = enkiCreateTaskSet(taskScheduler, job);
+			enkiAddTaskSetMinRange(taskScheduler, task, this, chunkCount, 1);
+			enkiWaitForTaskSet(taskScheduler, task);
+			enkiDeleteTaskSet(taskScheduler, task);
+		}
+		else
+		{
+			job(0, chunkCount, 0, this);
+		}
+	}
+
+	static void HistogramJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		RadixSort& sort = *(RadixSort*)data;
+		const std::vector<uint64_t>& sourceKeys = *sort.keys[sort.source];
+
+		for (uint32_t chunk = start; chunk < end; chunk++)
+		{
+			uint32_t* histogram = &sort.histograms[chunk * s_DigitCount];
+			std::fill(histogram, histogram + s_DigitCount, 0);
+
+			const uint32_t first = chunk * sort.chunkSize;
+			const uint32_t last = std::min<uint32_t>(first + sort.chunkSize, static_cast<uint32_t>(sourceKeys.size()));
+
+			for (uint32_t i = first; i < last; i++)
+			{
+				histogram[(sourceKeys[i] >> sort.shift) & (s_DigitCount - 1)]++;
+			}
+		}
+	}
+
+	static void ScatterJob(uint32_t start, uint32_t end, uint32_t threadnum, void* data)
+	{
+		RadixSort& sort = *(RadixSort*)data;
+		const std::vector<uint64_t>& sourceKeys = *sort.keys[sort.source];
+		const std::vector<uint32_t>& sourceValues = *sort.values[sort.source];
+		std::vector<uint64_t>& destinationKeys = *sort.keys[1 - sort.source];
+		std::vector<uint32_t>& destinationValues = *sort.values[1 - sort.source];
+
+		for (uint32_t chunk = start; chunk < end; chunk++)
+		{
+			uint32_t* offsets = &sort.histograms[chunk * s_DigitCount];
+
+			const uint32_t first = chunk * sort.chunkSize;
+			const uint32_t last = std::min<uint32_t>(first + sort.chunkSize, static_cast<uint32_t>(sourceKeys.size()));
+
+			for (uint32_t i = first; i < last; i++)
+			{
+				uint32_t destination = offsets[(sourceKeys[i] >> sort.shift) & (s_DigitCount - 1)]++;
+				destinationKeys[destination] = sourceKeys[i];
+				destinationValues[destination] = sourceValues[i];
+			}
+		}
+	}
+
+	std::vector<uint64_t>*	keys[2];
+	std::vector<uint32_t>*	values[2];
+	std::vector<uint64_t>	tempKeys;
+	std::vector<uint32_t>	tempValues;
+	std::vector<uint32_t>	histograms;	// s_DigitCount counters per chunk.
+	uint32_t				chunkCount = 1;
+	uint32_t				chunkSize = 0;
+	uint32_t				source = 0;
+	uint32_t				shift = 0;
+};
+
+#endif // MORTON_H
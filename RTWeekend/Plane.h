@@ -0,0 +1,78 @@
+#ifndef PLANE_H
+#define PLANE_H
+
+#include "Geometry.h"
+#include "Vector3f.h"
+#include "Material.h"
+
+// Infinite plane through point, facing along normal. Planes are unbounded, so a Scene tests them against every ray
+// outside of its acceleration structure, see Geometry::IsBounded. Use a Quad for a bounded part of a plane.
+// UVs are the coordinates of the hit along two tangents of the plane, in world units from point.
+class Plane : public Geometry
+{
+public:
+	Plane(shared_ptr<Material> material, const Vector3f& point, const Vector3f& normal)
+	{
+		this->material = material;
+		this->point = point;
+		this->normal = Normalize(normal);
+
+		tangent = Normalize(Cross((fabsf(this->normal.x) > 0.9f) ? Vector3f(0, 1, 0) : Vector3f(1, 0, 0), this->normal));
+		bitangent = Cross(this->normal, tangent);
+		distance = Dot(this->normal, point);
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		const float denominator = Dot(normal, rayDesc.ray.direction);
+		if (denominator == 0.0f)
+			return false;
+
+		const float t = (distance - Dot(normal, rayDesc.ray.origin)) / denominator;
+		if (!(t >= rayDesc.tmin && t <= rayDesc.tmax))
+			return false;
+
+		hitDesc.t = t;
+		hitDesc.position = rayDesc.ray.At(t);
+		hitDesc.SetFaceNormal(rayDesc.ray, normal);
+
+		const Vector3f offset = hitDesc.position - point;
+		hitDesc.u = Dot(offset, tangent);
+		hitDesc.v = Dot(offset, bitangent);
+
+		hitDesc.material = material.get();
+		hitDesc.instanceID = 0;
+
+		return true;
+	}
+
+	virtual bool IsBounded() const override
+	{
+		return false;
+	}
+
+	// Infinite, except along the normal of planes facing a coordinate axis.
+	virtual void GetBoundingBox(AABB& aabb) const override
+	{
+		aabb = AABB(Vector3f::MinusInf, Vector3f::PlusInf);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (fabsf(normal[axis]) == 1.0f)
+			{
+				aabb.min[axis] = point[axis];
+				aabb.max[axis] = point[axis];
+			}
+		}
+	}
+
+public:
+	Vector3f point;
+	Vector3f normal;
+	Vector3f tangent;
+	Vector3f bitangent;
+	float distance;	// Of the plane from the origin, along the normal.
+	shared_ptr<Material> material;
+};
+
+#endif
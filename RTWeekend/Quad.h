@@ -0,0 +1,80 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "Geometry.h"
+#include "Vector3f.h"
+#include "Material.h"
+
+// Parallelogram corner + a * edgeU + b * edgeV for a, b in [0, 1], a bounded plane. The hit (a, b) are its UVs, and the
+// normal faces along Cross(edgeU, edgeV). Ray Tracing: The Next Week, Shirley, section 6.
+class Quad : public Geometry
+{
+public:
+	Quad(shared_ptr<Material> material, const Vector3f& corner, const Vector3f& edgeU, const Vector3f& edgeV)
+	{
+		this->material = material;
+		this->corner = corner;
+		this->edgeU = edgeU;
+		this->edgeV = edgeV;
+
+		const Vector3f n = Cross(edgeU, edgeV);
+		normal = Normalize(n);
+		distance = Dot(normal, corner);
+		w = n / Dot(n, n);
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		const float denominator = Dot(normal, rayDesc.ray.direction);
+		if (denominator == 0.0f)
+			return false;
+
+		const float t = (distance - Dot(normal, rayDesc.ray.origin)) / denominator;
+		if (!(t >= rayDesc.tmin && t <= rayDesc.tmax))
+			return false;
+
+		// Coordinates of the hit along the edges.
+		const Vector3f position = rayDesc.ray.At(t);
+		const Vector3f offset = position - corner;
+		const float a = Dot(w, Cross(offset, edgeV));
+		const float b = Dot(w, Cross(edgeU, offset));
+
+		if (!(a >= 0.0f && a <= 1.0f && b >= 0.0f && b <= 1.0f))
+			return false;
+
+		hitDesc.t = t;
+		hitDesc.position = position;
+		hitDesc.SetFaceNormal(rayDesc.ray, normal);
+		hitDesc.u = a;
+		hitDesc.v = b;
+		hitDesc.material = material.get();
+		hitDesc.instanceID = 0;
+
+		return true;
+	}
+
+	virtual void GetBoundingBox(AABB& aabb) const override
+	{
+		aabb = AABB(corner, corner);
+		aabb.Encapsulate(corner + edgeU);
+		aabb.Encapsulate(corner + edgeV);
+		aabb.Encapsulate(corner + edgeU + edgeV);
+	}
+
+	virtual void GetClippedBoundingBox(const AABB& clip, AABB& aabb) const override
+	{
+		const Vector3f vertices[4] = { corner, corner + edgeU, corner + edgeU + edgeV, corner + edgeV };
+		GetClippedPolygonBoundingBox(vertices, 4, clip, aabb);
+	}
+
+public:
+	Vector3f corner;
+	Vector3f edgeU;
+	Vector3f edgeV;
+	Vector3f normal;
+	Vector3f w;			// Cross(edgeU, edgeV) / |Cross(edgeU, edgeV)|^2, projects hits onto the edges.
+	float distance;		// Of the plane from the origin, along the normal.
+	shared_ptr<Material> material;
+};
+
+#endif
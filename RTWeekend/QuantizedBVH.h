@@ -0,0 +1,481 @@
+#ifndef QUANTIZED_BVH_H
+#define QUANTIZED_BVH_H
+
+#include <math.h>
+#include <vector>
+#include <immintrin.h>
+
+#include "BVHArray.h"
+#include "LinearBVH.h"
+
+// Interior node of a binary BVH with both child boxes stored as 8 bit fractions of the box of the node itself.
+// The node box is not stored: traversal decodes it from the parent and carries it down, starting from the root
+// bounds, so a node is 20 bytes where the two LinearBVHNode children it replaces take 64.
+// Codes are grouped so that each group of 4 converts to one SSE register, child 0 in lanes 0 and 2, child 1 in lanes 1 and 3.
+struct QuantizedBVHNode
+{
+	inline bool IsLeaf(int child) const { return (this->child[child] & s_QuantizedBVHLeaf) != 0; }
+
+	static const uint32_t s_QuantizedBVHLeaf = 0x80000000;
+	static const uint32_t s_QuantizedBVHCountShift = 27;
+
+	uint8_t		minXY[4];	// Min X of both children, then min Y, in 1/255ths of the node box counted up from its min.
+	uint8_t		maxXY[4];	// Max X of both children, then max Y, in 1/255ths of the node box counted down from its max.
+	uint8_t		z[4];		// Min Z of both children counted up, then max Z counted down.
+	uint32_t	child[2];	// Interior: node index. Leaf: s_QuantizedBVHLeaf | (primitive count - 1) << 27 | first primitive.
+};
+
+static_assert(sizeof(QuantizedBVHNode) == 20, "QuantizedBVHNode is expected to be 20 bytes.");
+
+// Bounding planes of the two children of a node in the lane order of QuantizedBVHNode: minXY and maxXY hold
+// [x child 0, x child 1, y child 0, y child 1], z holds [min child 0, min child 1, max child 0, max child 1].
+// A single box, like the frame a node is decoded in, has the same planes in both children's lanes.
+struct QuantizedBVHPlanes
+{
+	static QuantizedBVHPlanes FromAABB(const AABB& aabb)
+	{
+		QuantizedBVHPlanes planes;
+		planes.minXY = _mm_setr_ps(aabb.min.x, aabb.min.x, aabb.min.y, aabb.min.y);
+		planes.maxXY = _mm_setr_ps(aabb.max.x, aabb.max.x, aabb.max.y, aabb.max.y);
+		planes.z = _mm_setr_ps(aabb.min.z, aabb.min.z, aabb.max.z, aabb.max.z);
+		return planes;
+	}
+
+	// Box of one child, in both children's lanes.
+	inline QuantizedBVHPlanes Child(int child) const
+	{
+		QuantizedBVHPlanes planes;
+		if (child == 0)
+		{
+			planes.minXY = _mm_shuffle_ps(minXY, minXY, _MM_SHUFFLE(2, 2, 0, 0));
+			planes.maxXY = _mm_shuffle_ps(maxXY, maxXY, _MM_SHUFFLE(2, 2, 0, 0));
+			planes.z = _mm_shuffle_ps(z, z, _MM_SHUFFLE(2, 2, 0, 0));
+		}
+		else
+		{
+			planes.minXY = _mm_shuffle_ps(minXY, minXY, _MM_SHUFFLE(3, 3, 1, 1));
+			planes.maxXY = _mm_shuffle_ps(maxXY, maxXY, _MM_SHUFFLE(3, 3, 1, 1));
+			planes.z = _mm_shuffle_ps(z, z, _MM_SHUFFLE(3, 3, 1, 1));
+		}
+		return planes;
+	}
+
+	AABB ToAABB(int child) const
+	{
+		float minXYLanes[4], maxXYLanes[4], zLanes[4];
+		_mm_storeu_ps(minXYLanes, minXY);
+		_mm_storeu_ps(maxXYLanes, maxXY);
+		_mm_storeu_ps(zLanes, z);
+		return AABB(
+			Vector3f(minXYLanes[child], minXYLanes[2 + child], zLanes[child]),
+			Vector3f(maxXYLanes[child], maxXYLanes[2 + child], zLanes[2 + child]));
+	}
+
+	// Decodes the children of node, with this being the box of the node. Mins are frame.min + code * step and maxs
+	// frame.max - code * step, with step = (frame.max - frame.min) / 255 computed as in QuantizationStep, so
+	// code 0 gives back the frame planes exactly.
+	inline QuantizedBVHPlanes Decode(const QuantizedBVHNode& node) const
+	{
+		const __m128 inv255 = _mm_set1_ps(1.0f / 255.0f);
+		const __m128 negateMax = _mm_setr_ps(0.0f, 0.0f, -0.0f, -0.0f);
+
+		__m128 stepXY = _mm_mul_ps(_mm_sub_ps(maxXY, minXY), inv255);
+		__m128 stepZ = _mm_mul_ps(_mm_sub_ps(_mm_movehl_ps(z, z), z), inv255);
+		stepZ = _mm_xor_ps(_mm_shuffle_ps(stepZ, stepZ, _MM_SHUFFLE(0, 0, 0, 0)), negateMax);
+
+		// Zero extend the 12 codes to 32 bit integers.
+		__m128i codes = _mm_loadu_si128((const __m128i*)&node);
+		__m128i codes16 = _mm_unpacklo_epi8(codes, _mm_setzero_si128());
+		__m128 minXYCodes = _mm_cvtepi32_ps(_mm_unpacklo_epi16(codes16, _mm_setzero_si128()));
+		__m128 maxXYCodes = _mm_cvtepi32_ps(_mm_unpackhi_epi16(codes16, _mm_setzero_si128()));
+		__m128 zCodes = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpackhi_epi8(codes, _mm_setzero_si128()), _mm_setzero_si128()));
+
+		QuantizedBVHPlanes children;
+		children.minXY = _mm_add_ps(minXY, _mm_mul_ps(minXYCodes, stepXY));
+		children.maxXY = _mm_sub_ps(maxXY, _mm_mul_ps(maxXYCodes, stepXY));
+		children.z = _mm_add_ps(z, _mm_mul_ps(zCodes, stepZ));
+		return children;
+	}
+
+	__m128 minXY;
+	__m128 maxXY;
+	__m128 z;
+};
+
+// Grid step of a node box along each axis, the scalar equivalent of QuantizedBVHPlanes::Decode.
+inline Vector3f QuantizationStep(const AABB& aabb)
+{
+	return Vector3f(
+		(aabb.max.x - aabb.min.x) * (1.0f / 255.0f),
+		(aabb.max.y - aabb.min.y) * (1.0f / 255.0f),
+		(aabb.max.z - aabb.min.z) * (1.0f / 255.0f));
+}
+
+// Compressed copy of a LinearBVH: about a third of its node memory at the cost of decoding child boxes during
+// traversal. Child boxes grow by at most 1/255 of their parent box per axis and side.
+// The leaf primitives are shared with the binary BVH, whose nodes are no longer needed once built, see Unpack.
+class QuantizedBVH
+{
+public:
+	// Fails, leaving the tree empty, if the leaves reference more primitives than the 27 bits of a leaf can address.
+	bool Build(const LinearBVH& bvh)
+	{
+		Clear();
+
+		if (bvh.nodes.empty())
+			return true;
+
+		if (bvh.primitiveIndices.size() > s_QuantizedBVHMaxPrimitives)
+			return false;
+
+		primitives = &bvh.primitives;
+
+		const LinearBVHNode* binaryNodes = bvh.nodes.data();
+		const uint32_t binaryCount = static_cast<uint32_t>(bvh.nodes.size());
+
+		rootBounds = binaryNodes[0].aabb;
+
+		if (binaryNodes[0].IsLeaf())
+		{
+			root = EncodeLeaf(binaryNodes[0]);
+			return true;
+		}
+
+		// Interior binary nodes keep their relative order, so any node order of the binary BVH carries over and
+		// parents stay before their children.
+		std::vector<uint32_t> nodeIndices(binaryCount);
+		uint32_t nodeCount = 0;
+		for (uint32_t i = 0; i < binaryCount; i++)
+		{
+			nodeIndices[i] = nodeCount;
+			nodeCount += binaryNodes[i].IsLeaf() ? 0 : 1;
+		}
+
+		root = 0;
+
+		std::vector<QuantizedBVHNode> quantizedNodes(nodeCount);
+
+		// Decoded boxes of the interior nodes, which their children are encoded in. Parents come first in the
+		// binary BVH, so a forward sweep always has the frame of a node before reaching it.
+		std::vector<AABB> frames(binaryCount);
+		frames[0] = rootBounds;
+
+		for (uint32_t i = 0; i < binaryCount; i++)
+		{
+			if (binaryNodes[i].IsLeaf())
+				continue;
+
+			QuantizedBVHNode& node = quantizedNodes[nodeIndices[i]];
+			const AABB& frame = frames[i];
+
+			for (int child = 0; child < 2; child++)
+			{
+				const LinearBVHNode& childNode = binaryNodes[binaryNodes[i].offset + child];
+
+				EncodeChild(frame, childNode.aabb, node, child);
+				node.child[child] = childNode.IsLeaf() ? EncodeLeaf(childNode) : nodeIndices[binaryNodes[i].offset + child];
+			}
+
+			// Children are decoded exactly like traversal does, so their frames match bit for bit.
+			const QuantizedBVHPlanes children = QuantizedBVHPlanes::FromAABB(frame).Decode(node);
+
+			for (int child = 0; child < 2; child++)
+			{
+				if (!node.IsLeaf(child))
+					frames[binaryNodes[i].offset + child] = children.ToAABB(child);
+			}
+		}
+
+		nodes = quantizedNodes;
+		return true;
+	}
+
+	// Rebuilds the binary nodes the tree was built from, with exact bounds from the current primitive bounds. Each
+	// quantized node becomes a pair of binary nodes in its own order, so children still follow their parents.
+	void Unpack(BVHArray<LinearBVHNode>& binaryNodes) const
+	{
+		binaryNodes.clear();
+
+		if (root == s_QuantizedBVHEmpty)
+			return;
+
+		binaryNodes.resize(2 * nodes.size() + 1);
+
+		if (root & QuantizedBVHNode::s_QuantizedBVHLeaf)
+		{
+			UnpackLeaf(root, binaryNodes[0]);
+		}
+		else
+		{
+			// Binary index of each quantized node, known before the node is reached since parents come first.
+			std::vector<uint32_t> binaryIndices(nodes.size());
+			binaryIndices[root] = 0;
+
+			uint32_t binaryCount = 1;
+			for (uint32_t i = 0; i < nodes.size(); i++)
+			{
+				LinearBVHNode& parent = binaryNodes[binaryIndices[i]];
+				parent.offset = binaryCount;
+				parent.primitiveCount = 0;
+				parent.pad = 0;
+
+				for (int child = 0; child < 2; child++)
+				{
+					if (nodes[i].IsLeaf(child))
+						UnpackLeaf(nodes[i].child[child], binaryNodes[binaryCount + child]);
+					else
+						binaryIndices[nodes[i].child[child]] = binaryCount + child;
+				}
+
+				binaryCount += 2;
+			}
+		}
+
+		// Same bottom-up sweep as LinearBVH::Refit.
+		for (size_t i = binaryNodes.size(); i-- > 0;)
+		{
+			LinearBVHNode& node = binaryNodes[i];
+
+			if (node.IsLeaf())
+			{
+				node.aabb = AABB::Empty();
+				for (uint32_t p = node.offset; p < node.offset + node.primitiveCount; p++)
+				{
+					AABB aabb;
+					(*primitives)[p]->GetBoundingBox(aabb);
+					node.aabb.Encapsulate(aabb);
+				}
+			}
+			else
+			{
+				node.aabb = binaryNodes[node.offset].aabb;
+				node.aabb.Encapsulate(binaryNodes[node.offset + 1].aabb);
+			}
+		}
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		primitives = nullptr;
+		root = s_QuantizedBVHEmpty;
+	}
+
+	size_t GetMemorySize() const
+	{
+		return nodes.size() * sizeof(QuantizedBVHNode) + sizeof(rootBounds);
+	}
+
+	// Same ordered traversal as LinearBVH, with every stack entry carrying the decoded box of its node. Both children
+	// are decoded and tested at once. Leaf children are intersected as soon as their box is hit.
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (root == s_QuantizedBVHEmpty)
+			return false;
+
+		const TraversalRay ray(rayDesc.ray);
+
+		float tEntry;
+		if (!rootBounds.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry))
+			return false;
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		PrimitiveHit closestHit;
+
+		if (root & QuantizedBVHNode::s_QuantizedBVHLeaf)
+		{
+			if (!HitLeaf(root, tempRayDesc, hitDesc, closestHit))
+				return false;
+
+			closestHit.Resolve(tempRayDesc, hitDesc);
+			return true;
+		}
+
+		const QuantizedBVHNode* nodeData = nodes.data();
+
+		// Ray in the lane order of QuantizedBVHPlanes.
+		const __m128 originXY = _mm_setr_ps(ray.origin.x, ray.origin.x, ray.origin.y, ray.origin.y);
+		const __m128 invDirectionXY = _mm_setr_ps(ray.invDirection.x, ray.invDirection.x, ray.invDirection.y, ray.invDirection.y);
+		const __m128 originZ = _mm_set1_ps(ray.origin.z);
+		const __m128 invDirectionZ = _mm_set1_ps(ray.invDirection.z);
+		const __m128 directionIsNegativeXY = _mm_castsi128_ps(_mm_setr_epi32(
+			-ray.directionIsNegative[0], -ray.directionIsNegative[0], -ray.directionIsNegative[1], -ray.directionIsNegative[1]));
+		const bool directionIsNegativeZ = ray.directionIsNegative[2] != 0;
+		const __m128 roundUp = _mm_set1_ps(1.0f + 2.0f * s_AABBGamma3);
+
+		bool hitFound = false;
+
+		struct StackEntry
+		{
+			QuantizedBVHPlanes	frame;
+			uint32_t			nodeIndex;
+			float				tEntry;
+		};
+
+		StackEntry stack[s_BVHStackSize];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = root;
+		QuantizedBVHPlanes frame = QuantizedBVHPlanes::FromAABB(rootBounds);
+
+		while (true)
+		{
+			const QuantizedBVHNode& node = nodeData[nodeIndex];
+			const QuantizedBVHPlanes children = frame.Decode(node);
+
+			// Slab test of both children, picking the near and far planes from the direction signs like AABB::Hit.
+			__m128 nearXY = _mm_or_ps(_mm_and_ps(directionIsNegativeXY, children.maxXY), _mm_andnot_ps(directionIsNegativeXY, children.minXY));
+			__m128 farXY = _mm_or_ps(_mm_and_ps(directionIsNegativeXY, children.minXY), _mm_andnot_ps(directionIsNegativeXY, children.maxXY));
+			__m128 tNearXY = _mm_mul_ps(_mm_sub_ps(nearXY, originXY), invDirectionXY);
+			__m128 tFarXY = _mm_mul_ps(_mm_sub_ps(farXY, originXY), invDirectionXY);
+			__m128 tZ = _mm_mul_ps(_mm_sub_ps(children.z, originZ), invDirectionZ);
+			__m128 tNearZ = directionIsNegativeZ ? _mm_movehl_ps(tZ, tZ) : tZ;
+			__m128 tFarZ = directionIsNegativeZ ? tZ : _mm_movehl_ps(tZ, tZ);
+
+			// Exit distances are rounded up as in AABB::Hit.
+			tFarXY = _mm_mul_ps(tFarXY, roundUp);
+			tFarZ = _mm_mul_ps(tFarZ, roundUp);
+
+			// maxps / minps return the second operand when the first one is NaN, same as FMAX / FMIN.
+			__m128 tEntries = _mm_max_ps(tNearXY, _mm_max_ps(_mm_movehl_ps(tNearXY, tNearXY), _mm_max_ps(tNearZ, _mm_set1_ps(tempRayDesc.tmin))));
+			__m128 tExits = _mm_min_ps(tFarXY, _mm_min_ps(_mm_movehl_ps(tFarXY, tFarXY), _mm_min_ps(tFarZ, _mm_set1_ps(tempRayDesc.tmax))));
+
+			const int hitMask = _mm_movemask_ps(_mm_cmple_ps(tEntries, tExits)) & 3;
+
+			float childEntry[4];
+			_mm_storeu_ps(childEntry, tEntries);
+
+			const int nearChild = (childEntry[1] < childEntry[0]) ? 1 : 0;
+			bool descend = false;
+
+			for (int i = 0; i < 2; i++)
+			{
+				const int child = i ? 1 - nearChild : nearChild;
+
+				if (!(hitMask & (1 << child)) || childEntry[child] > tempRayDesc.tmax)
+					continue;
+
+				if (node.IsLeaf(child))
+				{
+					if (HitLeaf(node.child[child], tempRayDesc, hitDesc, closestHit))
+						hitFound = true;
+				}
+				else if (!descend)
+				{
+					descend = true;
+					nodeIndex = node.child[child];
+					frame = children.Child(child);
+				}
+				else
+				{
+					stack[stackSize++] = { children.Child(child), node.child[child], childEntry[child] };
+				}
+			}
+
+			if (descend)
+				continue;
+
+			// Pop the next subtree that can still contain a closer hit.
+			do
+			{
+				if (stackSize == 0)
+				{
+					closestHit.Resolve(tempRayDesc, hitDesc);
+					return hitFound;
+				}
+
+				stackSize--;
+			}
+			while (stack[stackSize].tEntry > tempRayDesc.tmax);
+
+			nodeIndex = stack[stackSize].nodeIndex;
+			frame = stack[stackSize].frame;
+		}
+	}
+
+private:
+	static const uint32_t s_QuantizedBVHEmpty = 0xFFFFFFFF;
+	static const uint32_t s_QuantizedBVHMaxPrimitives = 1u << QuantizedBVHNode::s_QuantizedBVHCountShift;
+
+	static_assert(s_BVHMaxLeafSize <= 16, "Quantized leaves encode at most 16 primitives.");
+
+	// Build checks that the offset fits below the count bits.
+	static uint32_t EncodeLeaf(const LinearBVHNode& leaf)
+	{
+		return QuantizedBVHNode::s_QuantizedBVHLeaf |
+			(static_cast<uint32_t>(leaf.primitiveCount - 1) << QuantizedBVHNode::s_QuantizedBVHCountShift) |
+			leaf.offset;
+	}
+
+	static void DecodeLeaf(uint32_t leaf, uint32_t& first, uint32_t& count)
+	{
+		first = leaf & (s_QuantizedBVHMaxPrimitives - 1);
+		count = ((leaf & ~QuantizedBVHNode::s_QuantizedBVHLeaf) >> QuantizedBVHNode::s_QuantizedBVHCountShift) + 1;
+	}
+
+	static void UnpackLeaf(uint32_t leaf, LinearBVHNode& node)
+	{
+		uint32_t first, count;
+		DecodeLeaf(leaf, first, count);
+
+		node.offset = first;
+		node.primitiveCount = static_cast<uint16_t>(count);
+		node.pad = 0;
+	}
+
+	bool HitLeaf(uint32_t leaf, RayDesc& tempRayDesc, HitDesc& hitDesc, PrimitiveHit& closestHit) const
+	{
+		uint32_t first, count;
+		DecodeLeaf(leaf, first, count);
+
+		return primitives->Hit(first, count, tempRayDesc, hitDesc, closestHit);
+	}
+
+	// Picks the tightest codes whose decoded planes still enclose aabb. The codes are checked with a couple of ulps
+	// to spare, so that the SIMD decoding stays conservative even if the compiler rounds this check differently.
+	static void EncodeChild(const AABB& frame, const AABB& aabb, QuantizedBVHNode& node, int child)
+	{
+		const Vector3f step = QuantizationStep(frame);
+
+		uint8_t* minCodes[3] = { &node.minXY[child], &node.minXY[2 + child], &node.z[child] };
+		uint8_t* maxCodes[3] = { &node.maxXY[child], &node.maxXY[2 + child], &node.z[2 + child] };
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float lower = nextafterf(nextafterf(aabb.min[axis], -infinity), -infinity);
+			const float upper = nextafterf(nextafterf(aabb.max[axis], infinity), infinity);
+
+			int minCode = 0;
+			int maxCode = 0;
+
+			if (step[axis] > 0.0f)
+			{
+				minCode = static_cast<int>(Clamp(floorf((aabb.min[axis] - frame.min[axis]) / step[axis]), 0.0f, 255.0f));
+				maxCode = static_cast<int>(Clamp(floorf((frame.max[axis] - aabb.max[axis]) / step[axis]), 0.0f, 255.0f));
+
+				while (minCode > 0 && frame.min[axis] + minCode * step[axis] > lower)
+				{
+					minCode--;
+				}
+
+				while (maxCode > 0 && frame.max[axis] - maxCode * step[axis] < upper)
+				{
+					maxCode--;
+				}
+			}
+
+			*minCodes[axis] = static_cast<uint8_t>(minCode);
+			*maxCodes[axis] = static_cast<uint8_t>(maxCode);
+		}
+	}
+
+public:
+	BVHArray<QuantizedBVHNode>		nodes;
+	const BVHPrimitives*			primitives = nullptr;	// Leaf primitives of the binary BVH it was built from.
+	AABB							rootBounds;
+	uint32_t						root = s_QuantizedBVHEmpty;	// Node index, or a leaf if the whole tree is one leaf.
+};
+
+#endif // QUANTIZED_BVH_H
@@ -1,6 +1,8 @@
 #ifndef RAY_H
 #define RAY_H
 
+#include <stdint.h>
+
 #include "Vector3f.h"
 
 class Ray
@@ -21,6 +23,24 @@ struct RayDesc
 	Ray ray;
 	float tmin;
 	float tmax;
+	uint32_t instanceInclusionMask = 0xFF;	// Same as the InstanceInclusionMask parameter of TraceRay, instances are skipped if (mask & instanceMask) == 0.
+};
+
+// Ray data computed once per acceleration structure query and reused by every box test.
+struct TraversalRay
+{
+	TraversalRay(const Ray& ray)
+	{
+		origin = ray.origin;
+		invDirection = 1.0f / ray.direction;
+		directionIsNegative[0] = invDirection.x < 0 ? 1 : 0;
+		directionIsNegative[1] = invDirection.y < 0 ? 1 : 0;
+		directionIsNegative[2] = invDirection.z < 0 ? 1 : 0;
+	}
+
+	Vector3f origin;
+	Vector3f invDirection;
+	int directionIsNegative[3];
 };
 
 #endif // RAY_H
@@ -1,23 +1,31 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <algorithm>
+#include <chrono>
 #include <vector>
 #include <memory>
 
-#include "BVH.h"
-#include "Geometry.h"
+#include "AccelerationStructure.h"
+#include "BVHAccelerationStructure.h"
+#include "DynamicBVH.h"
+#include "KdTree.h"
+#include "UniformGrid.h"
 
 using std::shared_ptr;
 using std::make_shared;
 using std::unique_ptr;
 using std::make_unique;
 
-#define USE_BVH 1
-
+// Geometries that are not Geometry::IsBounded, such as infinite planes, are kept out of the acceleration structure, whose
+// root box they would make infinite, and are tested against every ray before it, shortening the rays it traverses.
 class Scene
 {
 public:
-	Scene() = default;
+	Scene() :
+		accelerationStructure(make_unique<BVHAccelerationStructure>())
+	{
+	}
 
 	void Add(shared_ptr<Geometry> geometry)
 	{
@@ -26,57 +34,241 @@ public:
 
 	void Clear()
 	{
-#if USE_BVH
-		if (root)
+		accelerationStructure->Clear();
+		geometries.clear();
+		boundedGeometries.clear();
+		unboundedGeometries.clear();
+	}
+
+	// Adds a geometry to a scene whose acceleration structure is already built. Structures that do not support
+	// incremental edits, all but AccelerationStructureType::DynamicBVH, are rebuilt with the last build settings.
+	void Insert(shared_ptr<Geometry> geometry)
+	{
+		geometries.push_back(geometry);
+
+		if (!geometry->IsBounded())
 		{
-			root->Clear();
-			root.reset();
+			unboundedGeometries.push_back(geometry);
+			return;
 		}
-#endif
 
-		geometries.clear();
+		boundedGeometries.push_back(geometry);
+
+		if (!accelerationStructure->Insert(geometry.get()))
+			BuildAccelerationStructure(buildSettings);
 	}
 
-	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
-	{		
-#if USE_BVH
-		if (geometries.empty())
+	// Removes a geometry added with Add or Insert, rebuilding the acceleration structure if it cannot remove it in place.
+	// Returns false if the geometry is not part of the scene. The order of the remaining geometries is not preserved.
+	bool Remove(const Geometry* geometry)
+	{
+		auto it = std::find_if(geometries.begin(), geometries.end(), [geometry](const shared_ptr<Geometry>& g) { return g.get() == geometry; });
+		if (it == geometries.end())
 			return false;
 
-		// Hit calls update the tmax with the closest hit found during traversal.
-		RayDesc tempRayDesc = rayDesc;
+		// Keep the geometry alive until the acceleration structure no longer references it.
+		shared_ptr<Geometry> removed = *it;
+		*it = geometries.back();
+		geometries.pop_back();
 
-		return root->Hit(tempRayDesc, hitDesc);
-#else
-		bool hitFound = false;
+		if (!removed->IsBounded())
+		{
+			RemoveFromList(unboundedGeometries, geometry);
+			return true;
+		}
+
+		RemoveFromList(boundedGeometries, geometry);
+
+		if (!accelerationStructure->Remove(geometry))
+			BuildAccelerationStructure(buildSettings);
+
+		return true;
+	}
+
+	// Call after a single geometry moved or changed size. Cheaper than UpdateAccelerationStructure for interactive edits
+	// with AccelerationStructureType::DynamicBVH, which reinserts the geometry. Other structures are refitted or rebuilt.
+	void UpdateGeometry(const Geometry* geometry)
+	{
+		if (!geometry->IsBounded())
+			return;
+
+		if (!accelerationStructure->UpdateGeometry(geometry))
+			BuildAccelerationStructure(buildSettings);
+	}
+
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (unboundedGeometries.empty())
+			return accelerationStructure->Hit(rayDesc, hitDesc);
 
 		RayDesc tempRayDesc = rayDesc;
+		bool hitFound = false;
 
-		for (const auto& geom : geometries)
+		for (const auto& geometry : unboundedGeometries)
 		{
-			if (geom->Hit(tempRayDesc, hitDesc))
+			if (geometry->Hit(tempRayDesc, hitDesc))
 			{
 				hitFound = true;
 				tempRayDesc.tmax = hitDesc.t;
 			}
 		}
 
+		if (accelerationStructure->Hit(tempRayDesc, hitDesc))
+			hitFound = true;
+
 		return hitFound;
-#endif
 	}
 
-	void BuildAccelerationStructure()
+	// Builds the acceleration structure of settings.type, replacing the current one if it is of another type.
+	// BVH subtrees are only built once rays reach them when settings.lazySubtreeSize is set.
+	void BuildAccelerationStructure(const BVHBuildSettings& settings = BVHBuildSettings())
 	{
-#if USE_BVH
-		root = make_unique<BVHNode>(geometries, 0, geometries.size());
-#endif
+		const auto buildStart = std::chrono::steady_clock::now();
+
+		buildSettings = settings;
+
+		if (accelerationStructure->GetType() != settings.type)
+			accelerationStructure = CreateAccelerationStructure(settings.type);
+
+		PartitionGeometries();
+		accelerationStructure->Build(boundedGeometries, settings);
+
+		buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - buildStart).count();
+	}
+
+	// Tree quality, node counts and memory of the acceleration structure, for comparing build settings and scenes.
+	// Pass rays, typically camera rays, to also measure how many nodes and primitives they visit in the binary BVH.
+	// Counting uses the profiling counters, so this must not be called between Begin and EndAccelerationStructureProfiling.
+	// Structures other than the BVH only report their memory and build time.
+	BVHStats ComputeAccelerationStructureStats(const std::vector<RayDesc>* rays = nullptr)
+	{
+		BVHStats stats;
+
+		if (BVHAccelerationStructure* bvh = GetBVH())
+			stats = bvh->ComputeStats(rays);
+		else
+			stats.layoutMemorySize = accelerationStructure->GetMemorySize();
+
+		stats.buildTime = buildTime;
+
+		return stats;
+	}
+
+	// Starts counting node visits for BVHNodeOrder::VisitCount, typically followed by a low resolution profiling render.
+	// Rays traverse the binary layout until EndAccelerationStructureProfiling. BVH only.
+	void BeginAccelerationStructureProfiling()
+	{
+		if (BVHAccelerationStructure* bvh = GetBVH())
+			bvh->BeginProfiling();
+	}
+
+	// Packs the nodes visited most during profiling at the front of the node array, then collapses the wide layout again.
+	void EndAccelerationStructureProfiling()
+	{
+		if (BVHAccelerationStructure* bvh = GetBVH())
+			bvh->EndProfiling();
+	}
+
+	// Writes the acceleration structure to a file that LoadAccelerationStructure can map later for the same geometries.
+	// BVH only.
+	bool SaveAccelerationStructure(const char* path) const
+	{
+		const BVHAccelerationStructure* bvh = GetBVH();
+		return bvh && bvh->Save(path, boundedGeometries);
+	}
+
+	// Maps a file written by SaveAccelerationStructure and traverses it in place. Fails if the file is missing, from another
+	// version, or was built for different geometries, in which case BuildAccelerationStructure has to be called instead.
+	// Wide nodes are collapsed after loading if the file does not contain the requested layout.
+	bool LoadAccelerationStructure(const char* path, const BVHBuildSettings& settings = BVHBuildSettings())
+	{
+		PartitionGeometries();
+
+		unique_ptr<BVHAccelerationStructure> bvh = make_unique<BVHAccelerationStructure>();
+		if (!bvh->Load(path, boundedGeometries, settings))
+			return false;
+
+		buildSettings = settings;
+		buildSettings.type = AccelerationStructureType::BVH;
+		buildTime = 0.0;
+
+		accelerationStructure = std::move(bvh);
+
+		return true;
+	}
+
+	// Call after geometries moved. Refits the acceleration structure in place, or rebuilds it with the last build settings
+	// when refitting has degraded it too much or it cannot be refitted. Returns true if it was rebuilt.
+	bool UpdateAccelerationStructure()
+	{
+		if (accelerationStructure->Refit())
+			return false;
+
+		BuildAccelerationStructure(buildSettings);
+		return true;
+	}
+
+	// The BVH, if it is the current acceleration structure.
+	BVHAccelerationStructure* GetBVH()
+	{
+		return (accelerationStructure->GetType() == AccelerationStructureType::BVH) ? static_cast<BVHAccelerationStructure*>(accelerationStructure.get()) : nullptr;
+	}
+
+	const BVHAccelerationStructure* GetBVH() const
+	{
+		return (accelerationStructure->GetType() == AccelerationStructureType::BVH) ? static_cast<const BVHAccelerationStructure*>(accelerationStructure.get()) : nullptr;
+	}
+
+private:
+	void PartitionGeometries()
+	{
+		boundedGeometries.clear();
+		unboundedGeometries.clear();
+
+		for (const auto& geometry : geometries)
+		{
+			if (geometry->IsBounded())
+				boundedGeometries.push_back(geometry);
+			else
+				unboundedGeometries.push_back(geometry);
+		}
+	}
+
+	static void RemoveFromList(std::vector<shared_ptr<Geometry>>& list, const Geometry* geometry)
+	{
+		// Geometries added since the last build are not in the lists yet.
+		auto it = std::find_if(list.begin(), list.end(), [geometry](const shared_ptr<Geometry>& g) { return g.get() == geometry; });
+		if (it == list.end())
+			return;
+
+		*it = list.back();
+		list.pop_back();
+	}
+
+	static unique_ptr<AccelerationStructure> CreateAccelerationStructure(AccelerationStructureType type)
+	{
+		switch (type)
+		{
+		case AccelerationStructureType::BruteForce:
+			return make_unique<BruteForceAccelerationStructure>();
+		case AccelerationStructureType::UniformGrid:
+			return make_unique<UniformGrid>();
+		case AccelerationStructureType::KdTree:
+			return make_unique<KdTree>();
+		case AccelerationStructureType::DynamicBVH:
+			return make_unique<DynamicBVH>();
+		default:
+			return make_unique<BVHAccelerationStructure>();
+		}
 	}
 
 public:
-#if USE_BVH
-	unique_ptr<BVHNode>					root;
-#endif
-	std::vector<shared_ptr<Geometry>>	geometries;
+	BVHBuildSettings					buildSettings;
+	unique_ptr<AccelerationStructure>	accelerationStructure;
+	double								buildTime = 0.0;	// Seconds taken by the last BuildAccelerationStructure.
+	std::vector<shared_ptr<Geometry>>	geometries;				// All geometries, in the order they were added.
+	std::vector<shared_ptr<Geometry>>	boundedGeometries;		// Those in the acceleration structure, as of the last build.
+	std::vector<shared_ptr<Geometry>>	unboundedGeometries;	// Those tested against every ray.
 };
 
 
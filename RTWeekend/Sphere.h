@@ -34,7 +34,8 @@ public:
 		v = theta / pi;
 	}
 
-	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	// Distance to the nearest intersection with the sphere in [tmin, tmax], without the hit attributes.
+	static inline bool Intersect(const Vector3f& center, float radius2, const RayDesc& rayDesc, float& t)
 	{
 		Vector3f oc = rayDesc.ray.origin - center;
 		float a = rayDesc.ray.direction.LengthSquared();
@@ -55,22 +56,106 @@ public:
 				return false;
 		}
 
-		hitDesc.t = root;
-		hitDesc.position = rayDesc.ray.At(root);
+		t = root;
+		return true;
+	}
+
+	void SetHitAttributes(const RayDesc& rayDesc, float t, HitDesc& hitDesc) const
+	{
+		hitDesc.t = t;
+		hitDesc.position = rayDesc.ray.At(t);
 		Vector3f outwardNormal = (hitDesc.position - center) * invRadius;				
 		hitDesc.SetFaceNormal(rayDesc.ray, outwardNormal);
 		GetUVs(outwardNormal, hitDesc.u, hitDesc.v);
 		hitDesc.material = material.get();
+		hitDesc.instanceID = 0;	// Instance::Hit sets it again for instanced spheres.
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		float t;
+		if (!Intersect(center, radius2, rayDesc, t))
+			return false;
+
+		SetHitAttributes(rayDesc, t, hitDesc);
 
 		return true;
 	}
 
+	virtual GeometryType GetType() const override
+	{
+		return GeometryType::Sphere;
+	}
+
 	virtual void GetBoundingBox(AABB& aabb) const override
 	{
 		aabb.min = center - Vector3f(radius, radius, radius);
 		aabb.max = center + Vector3f(radius, radius, radius);
 	}
 
+	virtual void GetClippedBoundingBox(const AABB& clip, AABB& aabb) const override
+	{
+		// Surface points inside clip are at a distance from the center plane of each axis between sqrt(r^2 - dmax^2) and
+		// sqrt(r^2 - dmin^2), where dmin / dmax are the nearest / farthest distances to clip on the two other axes.
+		// This bounds two caps per axis. The radius is padded so that rounding never makes the bounds too tight.
+		const float epsilon = radius * 1e-5f;
+		const float outerRadius2 = (radius + epsilon) * (radius + epsilon);
+		const float innerRadius2 = (radius - epsilon) * (radius - epsilon);
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float nearest2 = 0.0f;
+			float farthest2 = 0.0f;
+
+			for (int other = 0; other < 3; other++)
+			{
+				if (other == axis)
+					continue;
+
+				float lo = clip.min[other] - center[other];
+				float hi = clip.max[other] - center[other];
+				float nearest = (lo > 0.0f) ? lo : (hi < 0.0f) ? hi : 0.0f;
+				nearest2 += nearest * nearest;
+				farthest2 += FMAX(lo * lo, hi * hi);
+			}
+
+			if (nearest2 > outerRadius2)
+			{
+				aabb = AABB::Empty();
+				return;
+			}
+
+			float outer = sqrtf(outerRadius2 - nearest2);
+			float inner = (farthest2 < innerRadius2) ? sqrtf(innerRadius2 - farthest2) : 0.0f;
+
+			float lower0 = FMAX(center[axis] - outer, clip.min[axis]);
+			float lower1 = FMIN(center[axis] - inner, clip.max[axis]);
+			float upper0 = FMAX(center[axis] + inner, clip.min[axis]);
+			float upper1 = FMIN(center[axis] + outer, clip.max[axis]);
+
+			aabb.min[axis] = infinity;
+			aabb.max[axis] = -infinity;
+
+			if (lower0 <= lower1)
+			{
+				aabb.min[axis] = lower0;
+				aabb.max[axis] = lower1;
+			}
+
+			if (upper0 <= upper1)
+			{
+				aabb.min[axis] = FMIN(aabb.min[axis], upper0);
+				aabb.max[axis] = FMAX(aabb.max[axis], upper1);
+			}
+
+			if (aabb.min[axis] > aabb.max[axis])
+			{
+				aabb = AABB::Empty();
+				return;
+			}
+		}
+	}
+
 public:
 	Vector3f center;
 	float radius;
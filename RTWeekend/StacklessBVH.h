@@ -0,0 +1,217 @@
+#ifndef STACKLESS_BVH_H
+#define STACKLESS_BVH_H
+
+#include <vector>
+
+#include "LinearBVH.h"
+
+// LinearBVHNode with a link to its parent instead of padding, and the axis the children are ordered along.
+// Siblings stay adjacent, at indices 2u - 1 and 2u, so the sibling of a node is found without a link.
+struct StacklessBVHNode
+{
+	static const uint32_t s_StacklessBVHLeaf = 0x80000000;
+	static const uint32_t s_StacklessBVHRightLower = 0x20000000;	// Interior: the right child lies below the left one along the axis.
+	static const uint32_t s_StacklessBVHInfoShift = 27;
+	static const uint32_t s_StacklessBVHParentMask = (1u << s_StacklessBVHInfoShift) - 1;	// Also the parent of the root.
+
+	inline bool IsLeaf() const { return (link & s_StacklessBVHLeaf) != 0; }
+	inline uint32_t Parent() const { return link & s_StacklessBVHParentMask; }
+	inline uint32_t PrimitiveCount() const { return ((link >> s_StacklessBVHInfoShift) & 15) + 1; }
+	inline int Axis() const { return static_cast<int>((link >> s_StacklessBVHInfoShift) & 3); }
+	inline bool RightLower() const { return (link & s_StacklessBVHRightLower) != 0; }
+
+	AABB		aabb;
+	uint32_t	offset;	// Leaf: index of the first primitive. Interior: index of the left child, the right child follows it.
+	uint32_t	link;	// Parent index in the low 27 bits. Leaf: s_StacklessBVHLeaf | (primitive count - 1) << 27. Interior: axis << 27, s_StacklessBVHRightLower.
+};
+
+static_assert(sizeof(StacklessBVHNode) == 32, "StacklessBVHNode is expected to be 32 bytes.");
+
+// Binary BVH traversed without a stack, Hapala et al., "Efficient Stack-less BVH Traversal for Ray Tracing", 2011.
+// Traversal walks the tree as a state machine, going back up through parent links and over to the far sibling, so the
+// state of a ray in flight is a node index and one of three states instead of a stack of up to s_BVHStackSize entries.
+// Children are still visited near first along the axis their centroids are furthest apart on, and subtrees are culled
+// against the closest hit found so far, but going back up costs extra node loads compared to popping a stack.
+class StacklessBVH
+{
+public:
+	void Build(const LinearBVH& bvh)
+	{
+		Clear();
+
+		if (bvh.nodes.empty())
+			return;
+
+		primitives = bvh.primitives;
+
+		const uint32_t nodeCount = static_cast<uint32_t>(bvh.nodes.size());
+		const LinearBVHNode* nodeData = bvh.nodes.data();
+
+		nodes.resize(nodeCount);
+		nodes[0].link = StacklessBVHNode::s_StacklessBVHParentMask;
+
+		// Children are always stored after their parent, so the parent link of a node is set before it is reached.
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			const LinearBVHNode& source = nodeData[i];
+			StacklessBVHNode& node = nodes[i];
+
+			node.aabb = source.aabb;
+			node.offset = source.offset;
+
+			if (source.IsLeaf())
+			{
+				node.link |= StacklessBVHNode::s_StacklessBVHLeaf | (static_cast<uint32_t>(source.primitiveCount - 1) << StacklessBVHNode::s_StacklessBVHInfoShift);
+				continue;
+			}
+
+			const Vector3f leftCenter = nodeData[source.offset].aabb.Center();
+			const Vector3f rightCenter = nodeData[source.offset + 1].aabb.Center();
+			const Vector3f separation = rightCenter - leftCenter;
+
+			int axis = 0;
+			for (int a = 1; a < 3; a++)
+			{
+				if (fabsf(separation[a]) > fabsf(separation[axis]))
+					axis = a;
+			}
+
+			node.link |= static_cast<uint32_t>(axis) << StacklessBVHNode::s_StacklessBVHInfoShift;
+			if (separation[axis] < 0.0f)
+				node.link |= StacklessBVHNode::s_StacklessBVHRightLower;
+
+			nodes[source.offset].link = i;
+			nodes[source.offset + 1].link = i;
+		}
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		primitives.Clear();
+	}
+
+	size_t GetMemorySize() const
+	{
+		return nodes.size() * sizeof(StacklessBVHNode) + primitives.GetMemorySize();
+	}
+
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const StacklessBVHNode* nodeData = nodes.data();
+
+		const TraversalRay ray(rayDesc.ray);
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		float tEntry;
+		if (!nodeData[0].aabb.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry))
+			return false;
+
+		PrimitiveHit closestHit;
+
+		if (nodeData[0].IsLeaf())
+		{
+			if (!primitives.Hit(nodeData[0].offset, nodeData[0].PrimitiveCount(), tempRayDesc, hitDesc, closestHit))
+				return false;
+
+			closestHit.Resolve(tempRayDesc, hitDesc);
+			return true;
+		}
+
+		// Which child of an interior node is nearer only depends on the ray direction along the node axis.
+		const uint32_t directionNegative[3] =
+		{
+			rayDesc.ray.direction.x < 0.0f ? 1u : 0u,
+			rayDesc.ray.direction.y < 0.0f ? 1u : 0u,
+			rayDesc.ray.direction.z < 0.0f ? 1u : 0u,
+		};
+
+		auto nearChild = [&](const StacklessBVHNode& node)
+		{
+			return node.offset + (directionNegative[node.Axis()] ^ (node.RightLower() ? 1u : 0u));
+		};
+
+		enum class State
+		{
+			FromParent,		// Entering the near child of a node.
+			FromSibling,	// Entering the far child, after the near one.
+			FromChild,		// Going back up from a subtree that is done.
+		};
+
+		bool hitFound = false;
+
+		uint32_t nodeIndex = nearChild(nodeData[0]);
+		State state = State::FromParent;
+
+		while (true)
+		{
+			const StacklessBVHNode& node = nodeData[nodeIndex];
+
+			if (state == State::FromChild)
+			{
+				if (nodeIndex == 0)
+				{
+					closestHit.Resolve(tempRayDesc, hitDesc);
+					return hitFound;
+				}
+
+				// Coming up from the near child the far one is next, coming up from the far child the parent is done too.
+				const uint32_t parent = node.Parent();
+				if (nodeIndex == nearChild(nodeData[parent]))
+				{
+					nodeIndex = Sibling(nodeIndex);
+					state = State::FromSibling;
+				}
+				else
+				{
+					nodeIndex = parent;
+				}
+				continue;
+			}
+
+			if (node.aabb.Hit(ray, tempRayDesc.tmin, tempRayDesc.tmax, tEntry))
+			{
+				if (!node.IsLeaf())
+				{
+					nodeIndex = nearChild(node);
+					state = State::FromParent;
+					continue;
+				}
+
+				if (primitives.Hit(node.offset, node.PrimitiveCount(), tempRayDesc, hitDesc, closestHit))
+					hitFound = true;
+			}
+
+			// The node is done: the far sibling of a near child is next, the parent of a far child.
+			if (state == State::FromParent)
+			{
+				nodeIndex = Sibling(nodeIndex);
+				state = State::FromSibling;
+			}
+			else
+			{
+				nodeIndex = node.Parent();
+				state = State::FromChild;
+			}
+		}
+	}
+
+private:
+	static_assert(s_BVHMaxLeafSize <= 16, "Stackless leaves encode at most 16 primitives.");
+
+	static inline uint32_t Sibling(uint32_t nodeIndex)
+	{
+		return (nodeIndex & 1) ? nodeIndex + 1 : nodeIndex - 1;
+	}
+
+public:
+	std::vector<StacklessBVHNode>	nodes;		// nodes[0] is the root, in the order of the binary BVH.
+	BVHPrimitives					primitives;	// Copy of the leaf primitives of the binary BVH.
+};
+
+#endif // STACKLESS_BVH_H
@@ -0,0 +1,179 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <vector>
+
+#include "BVHTriangleList.h"
+#include "Geometry.h"
+#include "LinearBVH.h"
+#include "Material.h"
+
+// Indexed triangle mesh with shared vertex buffers, a single geometry of the scene however many triangles it has.
+// Like a bottom-level acceleration structure it keeps a BVH of its own over its triangles, so the scene BVH only sees
+// one primitive, and triangles are never heap objects: a triangle is three indices into the position buffer.
+// The leaves test their triangles with the SIMD watertight test of BVHTriangleList, and the hit attributes are only
+// computed for the closest hit, from the barycentric coordinates: interpolated normals and UVs when the mesh has them,
+// the normal of the counterclockwise winding and the barycentric coordinates otherwise.
+// The mesh BVH is built with the mode and leaf size of the settings, its layout is always binary and it is never lazy,
+// whatever lazySubtreeSize says.
+class TriangleMesh : public Geometry, private BVHPrimitiveSource
+{
+public:
+	// Triangle i is positions[indices[3i]], positions[indices[3i + 1]], positions[indices[3i + 2]]. normals, when not
+	// empty, holds one normal per position, and uvs, when not empty, two coordinates per position.
+	TriangleMesh(shared_ptr<Material> material, std::vector<Vector3f> positions, std::vector<uint32_t> indices,
+		std::vector<Vector3f> normals = std::vector<Vector3f>(), std::vector<float> uvs = std::vector<float>(),
+		const BVHBuildSettings& settings = BVHBuildSettings())
+	{
+		this->material = material;
+		this->positions = std::move(positions);
+		this->indices = std::move(indices);
+		this->normals = std::move(normals);
+		this->uvs = std::move(uvs);
+
+		Build(settings);
+	}
+
+	uint32_t GetTriangleCount() const
+	{
+		return static_cast<uint32_t>(indices.size() / 3);
+	}
+
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		uint32_t hitIndex = 0;
+		float b1 = 0.0f;
+		float b2 = 0.0f;
+
+		auto leafHit = [&](uint32_t first, uint32_t count, RayDesc& leafRayDesc)
+		{
+			return triangles.Hit(first, count, leafRayDesc, hitIndex, b1, b2);
+		};
+
+		if (!bvh.Traverse(tempRayDesc, leafHit))
+			return false;
+
+		SetHitAttributes(tempRayDesc, bvh.primitiveIndices[hitIndex], b1, b2, hitDesc);
+		return true;
+	}
+
+	virtual void GetBoundingBox(AABB& aabb) const override
+	{
+		aabb = bvh.nodes.empty() ? AABB::Empty() : bvh.nodes[0].aabb;
+	}
+
+	size_t GetMemorySize() const
+	{
+		return positions.size() * sizeof(Vector3f) + indices.size() * sizeof(uint32_t) + normals.size() * sizeof(Vector3f) +
+			uvs.size() * sizeof(float) + bvh.nodes.size() * sizeof(LinearBVHNode) + bvh.primitiveIndices.size() * sizeof(uint32_t) +
+			triangles.GetMemorySize();
+	}
+
+private:
+	void Build(const BVHBuildSettings& settings)
+	{
+		bvh.Clear();
+		triangles.Clear();
+
+		if (GetTriangleCount() == 0)
+			return;
+
+		// Like the subtrees of a LazyBVH, a mesh BVH is built in full.
+		BVHBuildSettings meshSettings = settings;
+		meshSettings.lazySubtreeSize = 0;
+
+		BVHBuilder builder(*this, meshSettings);
+		builder.Build();
+
+		bvh.Build(builder);
+
+		// The triangle list is in the order of the leaves. SBVH builds can reference a triangle from several leaves.
+		triangles.Resize(bvh.primitiveIndices.size());
+		for (size_t i = 0; i < bvh.primitiveIndices.size(); i++)
+		{
+			const uint32_t* triangle = &indices[3 * bvh.primitiveIndices[i]];
+			triangles.Set(i, positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]);
+		}
+	}
+
+	void SetHitAttributes(const RayDesc& rayDesc, uint32_t triangle, float b1, float b2, HitDesc& hitDesc) const
+	{
+		const uint32_t i0 = indices[3 * triangle];
+		const uint32_t i1 = indices[3 * triangle + 1];
+		const uint32_t i2 = indices[3 * triangle + 2];
+		const float b0 = 1.0f - b1 - b2;
+
+		hitDesc.t = rayDesc.tmax;
+		hitDesc.position = rayDesc.ray.At(rayDesc.tmax);
+
+		// Vertex normals, when the mesh has them, define its outward side instead of the winding, as in PBRT.
+		Vector3f outwardNormal;
+		if (normals.empty())
+			outwardNormal = Normalize(Cross(positions[i1] - positions[i0], positions[i2] - positions[i0]));
+		else
+			outwardNormal = Normalize(b0 * normals[i0] + b1 * normals[i1] + b2 * normals[i2]);
+		hitDesc.SetFaceNormal(rayDesc.ray, outwardNormal);
+
+		if (uvs.empty())
+		{
+			hitDesc.u = b1;
+			hitDesc.v = b2;
+		}
+		else
+		{
+			hitDesc.u = b0 * uvs[2 * i0] + b1 * uvs[2 * i1] + b2 * uvs[2 * i2];
+			hitDesc.v = b0 * uvs[2 * i0 + 1] + b1 * uvs[2 * i1 + 1] + b2 * uvs[2 * i2 + 1];
+		}
+
+		hitDesc.material = material.get();
+		hitDesc.instanceID = 0;	// Instance::Hit sets it again for instanced meshes.
+	}
+
+	// BVHPrimitiveSource, the primitives of the mesh BVH are its triangles.
+	virtual uint32_t GetPrimitiveCount() const override
+	{
+		return GetTriangleCount();
+	}
+
+	virtual void GetPrimitiveBoundingBox(uint32_t primitive, AABB& aabb) const override
+	{
+		aabb = AABB::Empty();
+		for (int vertex = 0; vertex < 3; vertex++)
+		{
+			aabb.Encapsulate(positions[indices[3 * primitive + vertex]]);
+		}
+	}
+
+	// Exact bounds of the part of the triangle inside clip.
+	virtual void GetClippedPrimitiveBoundingBox(uint32_t primitive, const AABB& clip, AABB& aabb) const override
+	{
+		const Vector3f triangle[3] =
+		{
+			positions[indices[3 * primitive]],
+			positions[indices[3 * primitive + 1]],
+			positions[indices[3 * primitive + 2]],
+		};
+
+		GetClippedPolygonBoundingBox(triangle, 3, clip, aabb);
+	}
+
+	virtual GeometryType GetPrimitiveType(uint32_t primitive) const override
+	{
+		return GeometryType::Other;
+	}
+
+public:
+	shared_ptr<Material>			material;
+	std::vector<Vector3f>			positions;
+	std::vector<uint32_t>			indices;			// Three per triangle.
+	std::vector<Vector3f>			normals;			// Per position, optional.
+	std::vector<float>				uvs;				// Two per position, optional.
+
+	LinearBVH						bvh;				// Mesh BVH, its primitive indices are the leaf triangles in depth-first order.
+	BVHTriangleList					triangles;			// Vertices of the same triangles.
+};
+
+#endif // TRIANGLE_MESH_H
@@ -0,0 +1,240 @@
+#ifndef UNIFORM_GRID_H
+#define UNIFORM_GRID_H
+
+#include <cmath>
+#include <vector>
+
+#include "AccelerationStructure.h"
+
+const uint32_t s_UniformGridMaxResolution = 256;
+
+// Uniform grid over the scene bounds. Every cell lists the geometries whose surface overlaps it, according to
+// Geometry::GetClippedBoundingBox, so a large sphere is only listed in the cells its surface crosses. Rays walk the
+// cells front to back with a 3D DDA, Amanatides and Woo, "A Fast Voxel Traversal Algorithm for Ray Tracing", 1987.
+// Cheap to build and good for evenly distributed geometries of similar sizes, poor for scenes with large empty areas.
+class UniformGrid : public AccelerationStructure
+{
+public:
+	virtual AccelerationStructureType GetType() const override
+	{
+		return AccelerationStructureType::UniformGrid;
+	}
+
+	virtual void Build(const std::vector<shared_ptr<Geometry>>& geometries, const BVHBuildSettings& settings) override
+	{
+		Clear();
+
+		const uint32_t geometryCount = static_cast<uint32_t>(geometries.size());
+		if (geometryCount == 0)
+			return;
+
+		std::vector<AABB> geometryBounds(geometryCount);
+
+		bounds = AABB::Empty();
+		for (uint32_t i = 0; i < geometryCount; i++)
+		{
+			geometries[i]->GetBoundingBox(geometryBounds[i]);
+			bounds.Encapsulate(geometryBounds[i]);
+		}
+
+		// Flat scenes still get cells of some thickness.
+		const float minExtent = std::max<float>(MaxComponent(bounds.Extent()) * 1e-3f, 1e-6f);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bounds.max[axis] = std::max<float>(bounds.max[axis], bounds.min[axis] + minExtent);
+		}
+
+		// Cubic cells, about gridDensity per geometry.
+		const Vector3f extent = bounds.Extent();
+		const float cellsPerUnit = std::cbrt(std::max<float>(settings.gridDensity, 0.0f) * geometryCount / (extent.x * extent.y * extent.z));
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			resolution[axis] = std::min<uint32_t>(std::max<uint32_t>(static_cast<uint32_t>(extent[axis] * cellsPerUnit), 1), s_UniformGridMaxResolution);
+			cellSize[axis] = extent[axis] / resolution[axis];
+			invCellSize[axis] = 1.0f / cellSize[axis];
+		}
+
+		const uint32_t cellCount = resolution[0] * resolution[1] * resolution[2];
+
+		// Counting sort of the (cell, geometry) pairs by cell.
+		std::vector<uint32_t> pairCells;
+		std::vector<uint32_t> pairGeometries;
+
+		for (uint32_t i = 0; i < geometryCount; i++)
+		{
+			uint32_t first[3];
+			uint32_t last[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				first[axis] = CellCoordinate(geometryBounds[i].min[axis], axis);
+				last[axis] = CellCoordinate(geometryBounds[i].max[axis], axis);
+			}
+
+			const bool singleCell = first[0] == last[0] && first[1] == last[1] && first[2] == last[2];
+
+			for (uint32_t z = first[2]; z <= last[2]; z++)
+			{
+				for (uint32_t y = first[1]; y <= last[1]; y++)
+				{
+					for (uint32_t x = first[0]; x <= last[0]; x++)
+					{
+						if (!singleCell)
+						{
+							// Cells are padded a little so that rounding in the traversal never misses a geometry.
+							const Vector3f padding = 1e-4f * cellSize;
+							const AABB cell(
+								bounds.min + Vector3f(float(x), float(y), float(z)) * cellSize - padding,
+								bounds.min + Vector3f(float(x + 1), float(y + 1), float(z + 1)) * cellSize + padding);
+
+							AABB part;
+							geometries[i]->GetClippedBoundingBox(cell, part);
+							if (part.IsEmpty())
+								continue;
+						}
+
+						pairCells.push_back(CellIndex(x, y, z));
+						pairGeometries.push_back(i);
+					}
+				}
+			}
+		}
+
+		cellStart.assign(cellCount + 1, 0);
+		for (uint32_t cell : pairCells)
+		{
+			cellStart[cell + 1]++;
+		}
+
+		for (uint32_t cell = 0; cell < cellCount; cell++)
+		{
+			cellStart[cell + 1] += cellStart[cell];
+		}
+
+		std::vector<uint32_t> next(cellStart.begin(), cellStart.end() - 1);
+		std::vector<uint32_t> indices(pairCells.size());
+		for (size_t i = 0; i < pairCells.size(); i++)
+		{
+			indices[next[pairCells[i]]++] = pairGeometries[i];
+		}
+
+		primitives.Build(geometries, indices.data(), indices.size());
+	}
+
+	virtual void Clear() override
+	{
+		cellStart.clear();
+		primitives.Clear();
+	}
+
+	// Geometries spanning several cells are tested in each of them. A hit beyond the current cell is kept as the closest
+	// so far, it only ends the traversal once the cell containing it is reached.
+	virtual bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const override
+	{
+		if (cellStart.empty())
+			return false;
+
+		const TraversalRay ray(rayDesc.ray);
+
+		float tEntry, tExit;
+		if (!bounds.Hit(ray, rayDesc.tmin, rayDesc.tmax, tEntry, tExit))
+			return false;
+
+		const Vector3f entry = rayDesc.ray.At(tEntry);
+
+		int cell[3];
+		int step[3];
+		int end[3];
+		float tNext[3];
+		float tDelta[3];
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			cell[axis] = static_cast<int>(CellCoordinate(entry[axis], axis));
+
+			const float direction = rayDesc.ray.direction[axis];
+
+			if (direction > 0.0f)
+			{
+				step[axis] = 1;
+				end[axis] = static_cast<int>(resolution[axis]);
+				tNext[axis] = (bounds.min[axis] + (cell[axis] + 1) * cellSize[axis] - rayDesc.ray.origin[axis]) * ray.invDirection[axis];
+				tDelta[axis] = cellSize[axis] * ray.invDirection[axis];
+			}
+			else if (direction < 0.0f)
+			{
+				step[axis] = -1;
+				end[axis] = -1;
+				tNext[axis] = (bounds.min[axis] + cell[axis] * cellSize[axis] - rayDesc.ray.origin[axis]) * ray.invDirection[axis];
+				tDelta[axis] = -cellSize[axis] * ray.invDirection[axis];
+			}
+			else
+			{
+				step[axis] = 0;
+				end[axis] = -1;
+				tNext[axis] = infinity;
+				tDelta[axis] = infinity;
+			}
+		}
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		bool hitFound = false;
+		PrimitiveHit closestHit;
+
+		while (true)
+		{
+			const uint32_t index = CellIndex(cell[0], cell[1], cell[2]);
+			const uint32_t first = cellStart[index];
+			const uint32_t count = cellStart[index + 1] - first;
+
+			if (count > 0 && primitives.Hit(first, count, tempRayDesc, hitDesc, closestHit))
+				hitFound = true;
+
+			const int axis = (tNext[0] < tNext[1]) ? ((tNext[0] < tNext[2]) ? 0 : 2) : ((tNext[1] < tNext[2]) ? 1 : 2);
+
+			if (tempRayDesc.tmax <= tNext[axis])
+			{
+				closestHit.Resolve(tempRayDesc, hitDesc);
+				return hitFound;
+			}
+
+			cell[axis] += step[axis];
+			if (cell[axis] == end[axis])
+			{
+				closestHit.Resolve(tempRayDesc, hitDesc);
+				return hitFound;
+			}
+
+			tNext[axis] += tDelta[axis];
+		}
+	}
+
+	virtual size_t GetMemorySize() const override
+	{
+		return cellStart.size() * sizeof(uint32_t) + primitives.GetMemorySize();
+	}
+
+private:
+	inline uint32_t CellCoordinate(float position, int axis) const
+	{
+		const float cell = (position - bounds.min[axis]) * invCellSize[axis];
+		return std::min<uint32_t>(static_cast<uint32_t>(std::max<float>(cell, 0.0f)), resolution[axis] - 1);
+	}
+
+	inline uint32_t CellIndex(uint32_t x, uint32_t y, uint32_t z) const
+	{
+		return (z * resolution[1] + y) * resolution[0] + x;
+	}
+
+public:
+	AABB					bounds;
+	uint32_t				resolution[3] = { 0, 0, 0 };
+	Vector3f				cellSize;
+	Vector3f				invCellSize;
+	std::vector<uint32_t>	cellStart;	// Geometries of a cell are primitives [cellStart[cell], cellStart[cell + 1]).
+	BVHPrimitives			primitives;
+};
+
+#endif // UNIFORM_GRID_H
@@ -73,6 +73,16 @@ public:
 		return *this *= 1 / t;
 	}
 
+	float operator[](int i) const
+	{
+		return (&x)[i];
+	}
+
+	float& operator[](int i)
+	{
+		return (&x)[i];
+	}
+
 	float LengthSquared() const
 	{
 		return x * x + y * y + z * z;
@@ -0,0 +1,485 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include <algorithm>
+#include <vector>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "BVHArray.h"
+#include "LinearBVH.h"
+
+// 8-wide nodes need AVX2 (/arch:AVX2 or -mavx2), otherwise BVHLayout::Wide8 falls back to 4-wide nodes.
+#if defined(__AVX2__)
+#define WIDE_BVH8_SUPPORTED 1
+#else
+#define WIDE_BVH8_SUPPORTED 0
+#endif
+
+// Child bounds are stored as structure of arrays so that all children are tested with one SIMD slab test.
+// Leaf children are stored inline: their slot references a primitive range instead of a node.
+template <int Width>
+struct WideBVHNode
+{
+	inline bool IsLeaf(int slot) const { return primitiveCount[slot] > 0; }
+
+	float		minX[Width];
+	float		minY[Width];
+	float		minZ[Width];
+	float		maxX[Width];
+	float		maxY[Width];
+	float		maxZ[Width];
+	uint32_t	offset[Width];			// Leaf: index of the first primitive. Interior: index of the child node.
+	uint16_t	primitiveCount[Width];	// 0 for interior children and empty slots.
+	uint16_t	pad[Width];
+};
+
+static_assert(sizeof(WideBVHNode<4>) == 128, "WideBVHNode<4> is expected to be two cache lines.");
+static_assert(sizeof(WideBVHNode<8>) == 256, "WideBVHNode<8> is expected to be four cache lines.");
+
+// SIMD slab test of a ray against all children of a node. Returns a bit mask of the children that are hit and
+// writes their entry distances. Empty slots have inverted infinite bounds and never pass the test.
+template <int Width>
+struct WideBVHSlabTest;
+
+template <>
+struct WideBVHSlabTest<4>
+{
+	WideBVHSlabTest(const TraversalRay& ray)
+	{
+		originX = _mm_set1_ps(ray.origin.x);
+		originY = _mm_set1_ps(ray.origin.y);
+		originZ = _mm_set1_ps(ray.origin.z);
+		invDirectionX = _mm_set1_ps(ray.invDirection.x);
+		invDirectionY = _mm_set1_ps(ray.invDirection.y);
+		invDirectionZ = _mm_set1_ps(ray.invDirection.z);
+		directionIsNegative[0] = ray.directionIsNegative[0];
+		directionIsNegative[1] = ray.directionIsNegative[1];
+		directionIsNegative[2] = ray.directionIsNegative[2];
+	}
+
+	inline uint32_t Hit(const WideBVHNode<4>& node, float tmin, float tmax, float* tEntries) const
+	{
+		const float* nearX = directionIsNegative[0] ? node.maxX : node.minX;
+		const float* farX = directionIsNegative[0] ? node.minX : node.maxX;
+		const float* nearY = directionIsNegative[1] ? node.maxY : node.minY;
+		const float* farY = directionIsNegative[1] ? node.minY : node.maxY;
+		const float* nearZ = directionIsNegative[2] ? node.maxZ : node.minZ;
+		const float* farZ = directionIsNegative[2] ? node.minZ : node.maxZ;
+
+		__m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearX), originX), invDirectionX);
+		__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farX), originX), invDirectionX);
+		__m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearY), originY), invDirectionY);
+		__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farY), originY), invDirectionY);
+		__m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nearZ), originZ), invDirectionZ);
+		__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(farZ), originZ), invDirectionZ);
+
+		// Exit distances are rounded up as in AABB::Hit.
+		const __m128 roundUp = _mm_set1_ps(1.0f + 2.0f * s_AABBGamma3);
+		tx1 = _mm_mul_ps(tx1, roundUp);
+		ty1 = _mm_mul_ps(ty1, roundUp);
+		tz1 = _mm_mul_ps(tz1, roundUp);
+
+		// maxps / minps return the second operand when the first one is NaN, same as FMAX / FMIN.
+		__m128 tEntry = _mm_max_ps(tx0, _mm_max_ps(ty0, _mm_max_ps(tz0, _mm_set1_ps(tmin))));
+		__m128 tExit = _mm_min_ps(tx1, _mm_min_ps(ty1, _mm_min_ps(tz1, _mm_set1_ps(tmax))));
+
+		_mm_storeu_ps(tEntries, tEntry);
+
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(tEntry, tExit)));
+	}
+
+	__m128 originX, originY, originZ;
+	__m128 invDirectionX, invDirectionY, invDirectionZ;
+	int directionIsNegative[3];
+};
+
+#if WIDE_BVH8_SUPPORTED
+template <>
+struct WideBVHSlabTest<8>
+{
+	WideBVHSlabTest(const TraversalRay& ray)
+	{
+		originX = _mm256_set1_ps(ray.origin.x);
+		originY = _mm256_set1_ps(ray.origin.y);
+		originZ = _mm256_set1_ps(ray.origin.z);
+		invDirectionX = _mm256_set1_ps(ray.invDirection.x);
+		invDirectionY = _mm256_set1_ps(ray.invDirection.y);
+		invDirectionZ = _mm256_set1_ps(ray.invDirection.z);
+		directionIsNegative[0] = ray.directionIsNegative[0];
+		directionIsNegative[1] = ray.directionIsNegative[1];
+		directionIsNegative[2] = ray.directionIsNegative[2];
+	}
+
+	inline uint32_t Hit(const WideBVHNode<8>& node, float tmin, float tmax, float* tEntries) const
+	{
+		const float* nearX = directionIsNegative[0] ? node.maxX : node.minX;
+		const float* farX = directionIsNegative[0] ? node.minX : node.maxX;
+		const float* nearY = directionIsNegative[1] ? node.maxY : node.minY;
+		const float* farY = directionIsNegative[1] ? node.minY : node.maxY;
+		const float* nearZ = directionIsNegative[2] ? node.maxZ : node.minZ;
+		const float* farZ = directionIsNegative[2] ? node.minZ : node.maxZ;
+
+		__m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearX), originX), invDirectionX);
+		__m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farX), originX), invDirectionX);
+		__m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearY), originY), invDirectionY);
+		__m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farY), originY), invDirectionY);
+		__m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nearZ), originZ), invDirectionZ);
+		__m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(farZ), originZ), invDirectionZ);
+
+		const __m256 roundUp = _mm256_set1_ps(1.0f + 2.0f * s_AABBGamma3);
+		tx1 = _mm256_mul_ps(tx1, roundUp);
+		ty1 = _mm256_mul_ps(ty1, roundUp);
+		tz1 = _mm256_mul_ps(tz1, roundUp);
+
+		__m256 tEntry = _mm256_max_ps(tx0, _mm256_max_ps(ty0, _mm256_max_ps(tz0, _mm256_set1_ps(tmin))));
+		__m256 tExit = _mm256_min_ps(tx1, _mm256_min_ps(ty1, _mm256_min_ps(tz1, _mm256_set1_ps(tmax))));
+
+		_mm256_storeu_ps(tEntries, tEntry);
+
+		return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ)));
+	}
+
+	__m256 originX, originY, originZ;
+	__m256 invDirectionX, invDirectionY, invDirectionZ;
+	int directionIsNegative[3];
+};
+#endif
+
+// BVH with Width children per node, built by collapsing a binary LinearBVH.
+template <int Width>
+class WideBVH
+{
+public:
+	void Build(const LinearBVH& bvh)
+	{
+		Clear();
+
+		if (bvh.nodes.empty())
+			return;
+
+		primitives = bvh.primitives;
+
+		nodes.reserve(bvh.nodes.size() / 2 + 1);
+		nodes.emplace_back();
+
+		if (bvh.nodes[0].IsLeaf())
+		{
+			// A single leaf still needs a root node to live in.
+			InitializeNode(0);
+			SetChild(nodes[0], 0, bvh.nodes[0]);
+		}
+		else
+		{
+			std::vector<uint32_t> sourceNodes(1, 0);
+			Collapse(bvh, 0, 0, sourceNodes);
+			SortBySourceNodes(sourceNodes);
+		}
+	}
+
+	// Uses count nodes at data, e.g. from a memory-mapped file, collapsed from the given binary BVH.
+	void Attach(const LinearBVH& bvh, const WideBVHNode<Width>* data, size_t count)
+	{
+		Clear();
+
+		primitives = bvh.primitives;
+		nodes.Attach(data, count);
+	}
+
+	void Clear()
+	{
+		nodes.clear();
+		primitives.Clear();
+	}
+
+	size_t GetMemorySize() const
+	{
+		return nodes.size() * sizeof(WideBVHNode<Width>);
+	}
+
+	// Recomputes the child bounds bottom-up from the current primitive bounds, keeping the tree topology.
+	// Child nodes are always stored after their parent, so a reverse sweep visits children first.
+	void Refit()
+	{
+		primitives.Refit();
+
+		for (size_t i = nodes.size(); i-- > 0;)
+		{
+			WideBVHNode<Width>& node = nodes[i];
+
+			for (int slot = 0; slot < Width; slot++)
+			{
+				AABB aabb = AABB::Empty();
+
+				if (node.IsLeaf(slot))
+				{
+					for (uint32_t p = node.offset[slot]; p < node.offset[slot] + node.primitiveCount[slot]; p++)
+					{
+						AABB primitiveAABB;
+						primitives[p]->GetBoundingBox(primitiveAABB);
+						aabb.Encapsulate(primitiveAABB);
+					}
+				}
+				else if (node.minX[slot] <= node.maxX[slot])
+				{
+					const WideBVHNode<Width>& child = nodes[node.offset[slot]];
+					for (int childSlot = 0; childSlot < Width; childSlot++)
+					{
+						aabb.Encapsulate(AABB(
+							Vector3f(child.minX[childSlot], child.minY[childSlot], child.minZ[childSlot]),
+							Vector3f(child.maxX[childSlot], child.maxY[childSlot], child.maxZ[childSlot])));
+					}
+				}
+				else
+				{
+					// Empty slot.
+					continue;
+				}
+
+				node.minX[slot] = aabb.min.x;
+				node.minY[slot] = aabb.min.y;
+				node.minZ[slot] = aabb.min.z;
+				node.maxX[slot] = aabb.max.x;
+				node.maxY[slot] = aabb.max.y;
+				node.maxZ[slot] = aabb.max.z;
+			}
+		}
+	}
+
+	bool Hit(const RayDesc& rayDesc, HitDesc& hitDesc) const
+	{
+		if (nodes.empty())
+			return false;
+
+		const WideBVHNode<Width>* nodeData = nodes.data();
+
+		const TraversalRay ray(rayDesc.ray);
+		const WideBVHSlabTest<Width> slabTest(ray);
+
+		// Hit calls update the tmax with the closest hit found during traversal.
+		RayDesc tempRayDesc = rayDesc;
+
+		bool hitFound = false;
+		PrimitiveHit closestHit;
+
+		struct StackEntry
+		{
+			uint32_t	nodeIndex;
+			float		tEntry;
+		};
+
+		StackEntry stack[s_BVHStackSize * (Width - 1)];
+		uint32_t stackSize = 0;
+
+		uint32_t nodeIndex = 0;
+
+		while (true)
+		{
+			const WideBVHNode<Width>& node = nodeData[nodeIndex];
+
+			float tEntries[Width];
+			uint32_t hitMask = slabTest.Hit(node, tempRayDesc.tmin, tempRayDesc.tmax, tEntries);
+
+			// Sort the hit children front to back.
+			int order[Width];
+			int hitCount = 0;
+			while (hitMask)
+			{
+				int slot = BitScanForward(hitMask);
+				hitMask &= hitMask - 1;
+
+				int i = hitCount++;
+				while (i > 0 && tEntries[order[i - 1]] > tEntries[slot])
+				{
+					order[i] = order[i - 1];
+					i--;
+				}
+				order[i] = slot;
+			}
+
+			// Intersect leaves right away so that their hits can cull the interior children.
+			int interiorCount = 0;
+			for (int i = 0; i < hitCount; i++)
+			{
+				int slot = order[i];
+
+				if (!node.IsLeaf(slot))
+				{
+					order[interiorCount++] = slot;
+					continue;
+				}
+
+				if (tEntries[slot] > tempRayDesc.tmax)
+					continue;
+
+				if (primitives.Hit(node.offset[slot], node.primitiveCount[slot], tempRayDesc, hitDesc, closestHit))
+					hitFound = true;
+			}
+
+			// Push the interior children far to near and continue with the nearest one.
+			for (int i = interiorCount - 1; i >= 0; i--)
+			{
+				int slot = order[i];
+				if (tEntries[slot] <= tempRayDesc.tmax)
+				{
+					stack[stackSize++] = { node.offset[slot], tEntries[slot] };
+				}
+			}
+
+			do
+			{
+				if (stackSize == 0)
+				{
+					closestHit.Resolve(tempRayDesc, hitDesc);
+					return hitFound;
+				}
+
+				stackSize--;
+			}
+			while (stack[stackSize].tEntry > tempRayDesc.tmax);
+
+			nodeIndex = stack[stackSize].nodeIndex;
+		}
+	}
+
+private:
+	static inline int BitScanForward(uint32_t mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	void InitializeNode(uint32_t index)
+	{
+		WideBVHNode<Width>& node = nodes[index];
+
+		for (int slot = 0; slot < Width; slot++)
+		{
+			node.minX[slot] = node.minY[slot] = node.minZ[slot] = infinity;
+			node.maxX[slot] = node.maxY[slot] = node.maxZ[slot] = -infinity;
+			node.offset[slot] = 0;
+			node.primitiveCount[slot] = 0;
+			node.pad[slot] = 0;
+		}
+	}
+
+	void SetChild(WideBVHNode<Width>& node, int slot, const LinearBVHNode& child)
+	{
+		node.minX[slot] = child.aabb.min.x;
+		node.minY[slot] = child.aabb.min.y;
+		node.minZ[slot] = child.aabb.min.z;
+		node.maxX[slot] = child.aabb.max.x;
+		node.maxY[slot] = child.aabb.max.y;
+		node.maxZ[slot] = child.aabb.max.z;
+		node.offset[slot] = child.offset;
+		node.primitiveCount[slot] = child.primitiveCount;
+	}
+
+	// Gathers up to Width descendants of an interior binary node by repeatedly opening the interior child
+	// with the largest surface area, then recurses into the interior ones.
+	void Collapse(const LinearBVH& bvh, uint32_t binaryIndex, uint32_t wideIndex, std::vector<uint32_t>& sourceNodes)
+	{
+		uint32_t children[Width];
+		int childCount = 0;
+
+		children[childCount++] = bvh.nodes[binaryIndex].offset;
+		children[childCount++] = bvh.nodes[binaryIndex].offset + 1;
+
+		while (childCount < Width)
+		{
+			int largest = -1;
+			float largestArea = -1.0f;
+
+			for (int i = 0; i < childCount; i++)
+			{
+				const LinearBVHNode& child = bvh.nodes[children[i]];
+				if (!child.IsLeaf() && child.aabb.SurfaceArea() > largestArea)
+				{
+					largest = i;
+					largestArea = child.aabb.SurfaceArea();
+				}
+			}
+
+			if (largest == -1)
+				break;
+
+			uint32_t opened = children[largest];
+			children[largest] = bvh.nodes[opened].offset;
+			children[childCount++] = bvh.nodes[opened].offset + 1;
+		}
+
+		InitializeNode(wideIndex);
+
+		for (int slot = 0; slot < childCount; slot++)
+		{
+			const LinearBVHNode& child = bvh.nodes[children[slot]];
+
+			SetChild(nodes[wideIndex], slot, child);
+
+			if (!child.IsLeaf())
+			{
+				uint32_t childIndex = static_cast<uint32_t>(nodes.size());
+				nodes.emplace_back();
+				nodes[wideIndex].offset[slot] = childIndex;
+				sourceNodes.push_back(children[slot]);
+
+				Collapse(bvh, children[slot], childIndex, sourceNodes);
+			}
+		}
+	}
+
+	// Stores the wide nodes in the order of the binary nodes they were collapsed from, so they follow the node order
+	// the binary BVH was laid out with. Parents still come before their children.
+	void SortBySourceNodes(const std::vector<uint32_t>& sourceNodes)
+	{
+		const uint32_t nodeCount = static_cast<uint32_t>(nodes.size());
+
+		std::vector<uint32_t> order(nodeCount);
+		for (uint32_t i = 0; i < nodeCount; i++)
+		{
+			order[i] = i;
+		}
+
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+		{
+			return sourceNodes[a] < sourceNodes[b];
+		});
+
+		std::vector<uint32_t> newIndices(nodeCount);
+		for (uint32_t position = 0; position < nodeCount; position++)
+		{
+			newIndices[order[position]] = position;
+		}
+
+		const WideBVHNode<Width>* nodeData = nodes.data();
+
+		std::vector<WideBVHNode<Width>> sorted(nodeCount);
+		for (uint32_t index = 0; index < nodeCount; index++)
+		{
+			WideBVHNode<Width> node = nodeData[index];
+			for (int slot = 0; slot < Width; slot++)
+			{
+				if (!node.IsLeaf(slot) && node.minX[slot] <= node.maxX[slot])
+					node.offset[slot] = newIndices[node.offset[slot]];
+			}
+
+			sorted[newIndices[index]] = node;
+		}
+
+		nodes = sorted;
+	}
+
+public:
+	BVHArray<WideBVHNode<Width>>	nodes;
+	BVHPrimitives					primitives;	// Copy of the leaf primitives of the collapsed binary BVH.
+};
+
+#endif // WIDE_BVH_H